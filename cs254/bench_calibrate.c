@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mitigate.h"
+
+// Calibration benchmark: black_box_mitigator over a target taking 0.8 to
+// 1.2 ms, evaluated serially and released in batches, with the fixed 0.1 s
+// default initial_q and with initial_q learned at a few percentiles.
+// Overhead is the mitigated run time over the raw, unmitigated one.
+//
+// Usage: bench-calibrate [secrets]
+
+static long long now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int target(int secret) {
+  struct timespec t = {0, 800000 + secret % 5 * 100000};
+  nanosleep(&t, NULL);
+  return secret;
+}
+
+static void run(const char *name, double percentile, int nsecrets,
+                double raw_s) {
+  struct mitigate_config cfg;
+  mitigate_config_init(&cfg);
+  cfg.nworkers = 1;
+  cfg.batch = 64; // a slot takes all that is ready, so every slot resets q
+  cfg.queue_capacity = nsecrets;
+  cfg.log_releases = 0;
+  cfg.out_fd = -1;
+  cfg.q_percentile = percentile;
+  mitigator_t *m = mitigate_create(&cfg);
+  unsigned long long *secrets = malloc(nsecrets * sizeof(*secrets));
+  if (m == NULL || secrets == NULL) {
+    perror("Failed to set up benchmark");
+    exit(1);
+  }
+  for (int i = 0; i < nsecrets; i++) {
+    secrets[i] = i * 7;
+  }
+  // A short run to learn from, still on the default quantum, then the one
+  // measured
+  if (percentile > 0)
+    black_box_mitigator(m, target, secrets, 20);
+  long long start = now_ns();
+  black_box_mitigator(m, target, secrets, nsecrets);
+  double seconds = (now_ns() - start) / 1e9;
+
+  static struct mitigate_stats stats;
+  mitigate_stats(m, &stats);
+  printf("%-8s %10.3f %9.1f%% %12.3f\n", name, seconds,
+         (seconds / raw_s - 1) * 100, stats.learned_q / 1e6);
+  free(secrets);
+  mitigate_destroy(m);
+}
+
+int main(int argc, char *argv[]) {
+  int nsecrets = argc > 1 ? atoi(argv[1]) : 500;
+
+  long long start = now_ns();
+  for (int i = 0; i < nsecrets; i++) {
+    target(i * 7);
+  }
+  double raw_s = (now_ns() - start) / 1e9;
+
+  printf("Policy: %s, %d secrets, raw %.3f s\n", mitigate_policy_name(),
+         nsecrets, raw_s);
+  printf("%-8s %10s %10s %12s\n", "q", "seconds", "overhead", "learned (ms)");
+  run("p50", 0.5, nsecrets, raw_s);
+  run("p90", 0.9, nsecrets, raw_s);
+  run("p99", 0.99, nsecrets, raw_s);
+  // The default takes 0.1 s per output; keep that run short
+  run("fixed", 0, nsecrets / 20, raw_s / 20);
+  return 0;
+}
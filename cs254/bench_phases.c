@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mitigate.h"
+#include "workloads.h"
+
+// Phase benchmark: parent_method's workload (see workloads.c), TOTAL_ROUNDS
+// outputs split by generate_phase_lengths into phases that each wait their
+// own random_delay between outputs, scaled from seconds to milliseconds and
+// repeated a few times. Linked once per policy; every build draws the same
+// phases from the same seed. Reports, for an initial_q near the first
+// phase's gaps (with and without a leakage budget) and for the default one,
+// how long outputs wait to be released, the run time against the
+// unmitigated one, and the leakage bound.
+//
+// Usage: bench-phases-<policy> [repeats]
+
+#define SEED 254
+
+struct output {
+  long long queued_ns;
+  long long released_ns;
+};
+
+static long long now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static void sleep_ns(long long ns) {
+  struct timespec t = {ns / 1000000000, ns % 1000000000};
+  nanosleep(&t, NULL);
+}
+
+static void released(const struct mitigate_output *out) {
+  struct output *o = out->ctx;
+  o->released_ns = now_ns();
+}
+
+static int cmp_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+// The delay before each output, phase by phase
+static long long *plan(int repeats, int *n) {
+  long long *delays = malloc(repeats * TOTAL_ROUNDS * sizeof(*delays));
+  if (delays == NULL)
+    return NULL;
+  srand(SEED);
+  *n = 0;
+  for (int r = 0; r < repeats; r++) {
+    int phases[MAX_PHASES], num_phases;
+    generate_phase_lengths(phases, &num_phases);
+    for (int i = 0; i < num_phases; i++) {
+      long long delay = random_delay(0, 4) * 1000000; // ms, not seconds
+      for (int j = 0; j < phases[i]; j++) {
+        delays[(*n)++] = delay;
+      }
+    }
+  }
+  return delays;
+}
+
+static void run(long long initial_q, double budget, const long long *delays,
+                int n) {
+  struct output *outs = calloc(n, sizeof(*outs));
+  long long *waits = malloc(n * sizeof(*waits));
+  struct mitigate_config cfg;
+  mitigate_config_init(&cfg);
+  cfg.initial_q = initial_q;
+  cfg.batch = 16; // a slot takes everything ready, so queues drain
+  cfg.queue_capacity = n;
+  cfg.log_releases = 0;
+  cfg.out_fd = -1;
+  cfg.leak_budget_bits = budget; // per second
+  mitigator_t *m = mitigate_create(&cfg);
+  mitigate_channel_t *ch = m != NULL ? mitigate_channel_create(m, NULL) : NULL;
+  if (outs == NULL || waits == NULL || ch == NULL) {
+    perror("Failed to set up benchmark");
+    exit(1);
+  }
+
+  long long raw_ns = 0, start = now_ns();
+  for (int i = 0; i < n; i++) {
+    sleep_ns(delays[i]);
+    raw_ns += delays[i];
+    outs[i].queued_ns = now_ns();
+    struct mitigate_output out = {
+        .release = released, .ctx = &outs[i], .value = i};
+    mitigate_submit_output(ch, &out);
+  }
+  mitigate_channel_drain(ch);
+  double overhead = (double)(now_ns() - start) / raw_ns - 1;
+  struct mitigate_channel_stats stats;
+  mitigate_channel_stats(ch, &stats);
+  mitigate_channel_destroy(ch);
+  mitigate_destroy(m);
+
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    waits[i] = outs[i].released_ns - outs[i].queued_ns;
+    sum += waits[i];
+  }
+  qsort(waits, n, sizeof(*waits), cmp_ll);
+  printf("%-12s %8.1f %7.0f %6d %9.2f %9.2f %9.2f %9.1f%% %7llu %9.1f\n",
+         mitigate_policy_name(), initial_q / 1e6, budget, n, sum / n / 1e6,
+         waits[n / 2] / 1e6, waits[n * 99 / 100] / 1e6, overhead * 100,
+         stats.epochs, stats.leakage_bits);
+  free(waits);
+  free(outs);
+}
+
+int main(int argc, char *argv[]) {
+  int repeats = argc > 1 ? atoi(argv[1]) : 4;
+  int n;
+  long long *delays = plan(repeats, &n);
+  if (delays == NULL) {
+    perror("Failed to set up benchmark");
+    return 1;
+  }
+  run(1000000, 0, delays, n); // about the gaps the workload starts with
+  run(1000000, 200, delays, n); // the same, held to 200 bits a second
+  run(100000000, 0, delays, n); // mitigate_config_init's default
+  free(delays);
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mitigate.h"
+#include "release_timer.h"
+#include "trace.h"
+
+// Release-jitter benchmark for the heap and wheel schedulers. Every channel
+// runs a constant quantum (link against the capped policy with
+// initial_q == max_q) and stays idle, so each one is served once per q and
+// all the release thread does is scheduling. Then times trace_emit, the cost
+// a trace adds to every submit, release and quantum change.
+//
+// Usage: bench-sched [q_ms] [seconds]
+
+static const int channel_counts[] = {1000, 10000, 100000};
+
+static void run(enum mitigate_scheduler scheduler, int nchannels,
+                long long q_ns, int seconds) {
+  struct mitigate_config cfg;
+  mitigate_config_init(&cfg);
+  cfg.initial_q = q_ns;
+  cfg.max_q = q_ns;
+  cfg.queue_capacity = 1;
+  cfg.nworkers = 1;
+  cfg.log_releases = 0;
+  cfg.scheduler = scheduler;
+  cfg.park_idle = 0; // keep the idle channels ticking
+  cfg.out_fd = -1;
+
+  mitigator_t *m = mitigate_create(&cfg);
+  mitigate_channel_t **channels = malloc(nchannels * sizeof(*channels));
+  if (m == NULL || channels == NULL) {
+    perror("Failed to set up benchmark");
+    exit(1);
+  }
+  for (int i = 0; i < nchannels; i++) {
+    channels[i] = mitigate_channel_create(m, NULL);
+    if (channels[i] == NULL) {
+      perror("Failed to create channel");
+      exit(1);
+    }
+  }
+
+  // Skip the first quantum, while channel creation is still settling
+  struct timespec warmup = {q_ns / 1000000000, q_ns % 1000000000};
+  nanosleep(&warmup, NULL);
+  static struct mitigate_stats before, after;
+  mitigate_stats(m, &before);
+  struct timespec window = {seconds, 0};
+  nanosleep(&window, NULL);
+  mitigate_stats(m, &after);
+
+  for (int i = 0; i < MITIGATE_LATENESS_BUCKETS; i++) {
+    after.lateness[i] -= before.lateness[i];
+  }
+  unsigned long long ticks = after.ticks - before.ticks;
+  double cpu = (double)(after.release_cpu_ns - before.release_cpu_ns) /
+               (seconds * 1e9) * 100;
+  printf("%-5s %7d %10llu %8lld %8lld %8lld %8lld %7.1f%%\n",
+         scheduler == MITIGATE_SCHED_WHEEL ? "wheel" : "heap", nchannels,
+         ticks, mitigate_lateness_percentile(&after, 0.5) / 1000,
+         mitigate_lateness_percentile(&after, 0.99) / 1000,
+         mitigate_lateness_percentile(&after, 0.999) / 1000,
+         mitigate_lateness_percentile(&after, 1.0) / 1000, cpu);
+
+  for (int i = 0; i < nchannels; i++) {
+    mitigate_channel_destroy(channels[i]);
+  }
+  free(channels);
+  mitigate_destroy(m);
+}
+
+#define TRACE_EVENTS 10000000
+#define TRACE_PATH "/tmp/bench-sched.trace"
+
+// ns per trace_emit on one thread, into a trace that wraps many times over,
+// bare and with the timestamp every call site in the engine takes
+static void run_trace(void) {
+  struct trace *t = trace_open(TRACE_PATH, 1 << 16, 4);
+  if (t == NULL) {
+    perror("Failed to open trace");
+    exit(1);
+  }
+  long long start = release_timer_now_ns();
+  for (int i = 0; i < TRACE_EVENTS; i++) {
+    trace_emit(t, TRACE_SUBMIT, start, 0, 0, 0, i, 1);
+  }
+  long long bare = release_timer_now_ns() - start;
+  start = release_timer_now_ns();
+  for (int i = 0; i < TRACE_EVENTS; i++) {
+    trace_emit(t, TRACE_SUBMIT, release_timer_now_ns(), 0, 0, 0, i, 1);
+  }
+  long long stamped = release_timer_now_ns() - start;
+  trace_close(t);
+  unlink(TRACE_PATH);
+  printf("trace_emit: %.1f ns per event, %.1f ns with its timestamp\n",
+         (double)bare / TRACE_EVENTS, (double)stamped / TRACE_EVENTS);
+}
+
+int main(int argc, char **argv) {
+  long long q_ms = argc > 1 ? atoll(argv[1]) : 100;
+  int seconds = argc > 2 ? atoi(argv[2]) : 2;
+
+  printf("q = %lld ms, %d s per run, lateness in us\n", q_ms, seconds);
+  printf("%-5s %7s %10s %8s %8s %8s %8s %8s\n", "sched", "chans", "releases",
+         "p50", "p99", "p99.9", "max", "cpu");
+  for (size_t i = 0; i < sizeof(channel_counts) / sizeof(channel_counts[0]);
+       i++) {
+    run(MITIGATE_SCHED_HEAP, channel_counts[i], q_ms * 1000000, seconds);
+    run(MITIGATE_SCHED_WHEEL, channel_counts[i], q_ms * 1000000, seconds);
+  }
+  run_trace();
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "mitigate.h"
+#include "workloads.h"
+
+// Usage: black-box-<policy> [TRACE], TRACE being a binary event trace to
+// write (decode it with trace2csv)
+int main(int argc, char *argv[]) {
+  flush_cache();
+  unsigned long long secrets[] = {pow(2, 17), pow(2, 18), pow(2, 19),
+                                  pow(2, 20), pow(2, 21)};
+  int secrets_size = sizeof(secrets) / sizeof(secrets[0]);
+
+  struct mitigate_config cfg;
+  mitigate_config_init(&cfg);
+  cfg.queue_capacity = secrets_size;
+  if (argc > 1)
+    cfg.trace_path = argv[1];
+
+  mitigator_t *m = mitigate_create(&cfg);
+  if (m == NULL) {
+    perror("Failed to create mitigator");
+    return 1;
+  }
+  printf("Policy: %s\n", mitigate_policy_name());
+  fflush(stdout); // releases are written straight to the fd, past stdio
+
+  // Run the black box mitigator to process the secrets and release the outputs
+  if (black_box_mitigator(m, diff_output_timing_leak, secrets, secrets_size) !=
+      0) {
+    perror("Mitigator run failed");
+    mitigate_destroy(m);
+    return 1;
+  }
+
+  mitigate_destroy(m);
+  return 0;
+}
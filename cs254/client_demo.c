@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mitigate_client.h"
+
+// mitigated client demo: submits a burst of outputs on a few channel keys
+// and prints each release as the daemon reports it. Run several at once on
+// the same keys to watch them share one schedule.
+//
+// Usage: client-demo [socket] [outputs per channel]
+
+static long long now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : NULL;
+  int per_channel = argc > 2 ? atoi(argv[2]) : 5;
+  const unsigned int nchannels = 3;
+
+  mitigate_client_t *c = mitigate_client_connect(path);
+  if (c == NULL) {
+    perror("Failed to connect to mitigated");
+    return 1;
+  }
+
+  long long start = now_ns();
+  int submitted = 0;
+  for (int i = 0; i < per_channel; i++) {
+    for (uint64_t ch = 0; ch < nchannels; ch++) {
+      if (mitigate_client_submit(c, ch, ch * 1000 + i) == 0)
+        submitted++;
+    }
+  }
+  printf("Submitted %d outputs on %u channels\n", submitted, nchannels);
+
+  for (int released = 0; released < submitted;) {
+    if (mitigate_client_wait(c, 5000) <= 0) {
+      fprintf(stderr, "Daemon gone or stalled\n");
+      break;
+    }
+    uint64_t ch, tag;
+    enum mitigate_client_status status;
+    int64_t time_ns;
+    while (mitigate_client_poll(c, &ch, &tag, &status, &time_ns)) {
+      printf("Channel %llu %s %llu at %lld ns\n", (unsigned long long)ch,
+             status == MITIGATE_CLIENT_REJECTED ? "rejected" : "released",
+             (unsigned long long)tag, (long long)(time_ns - start));
+      released++;
+    }
+  }
+  mitigate_client_close(c);
+  return 0;
+}
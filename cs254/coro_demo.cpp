@@ -0,0 +1,73 @@
+#include <atomic>
+#include <coroutine>
+#include <cstdio>
+#include <exception>
+
+#include "mitigate.hpp"
+extern "C" {
+#include "workloads.h"
+}
+
+// Coroutine demo: several sessions, each on its own channel, await mitigated
+// evaluations of the timing-leaky workload one after another. Every await
+// resumes on the release thread at the output's release slot.
+
+namespace {
+
+// Fire-and-forget coroutine that runs until its first await
+struct task {
+  struct promise_type {
+    task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+std::atomic<int> sessions_left;
+
+task session(mitigate_channel_t *ch, int first_secret) {
+  for (int i = 0; i < 3; i++) {
+    int secret = first_secret << i;
+    int output = co_await mitigate::mitigated(ch, diff_output_timing_leak,
+                                              secret);
+    std::printf("Session %u: secret %d -> %d\n", mitigate_channel_id(ch),
+                secret, output);
+  }
+  sessions_left--;
+  sessions_left.notify_one();
+}
+
+} // namespace
+
+int main() {
+  mitigate_config cfg;
+  mitigate_config_init(&cfg);
+  cfg.out_fd = -1; // outputs are delivered to the coroutines instead
+  cfg.log_releases = 0;
+
+  mitigator_t *m = mitigate_create(&cfg);
+  if (m == nullptr) {
+    std::perror("Failed to create mitigator");
+    return 1;
+  }
+  std::printf("Policy: %s\n", mitigate_policy_name());
+
+  const int nsessions = 4;
+  mitigate_channel_t *channels[nsessions];
+  sessions_left = nsessions;
+  for (int i = 0; i < nsessions; i++) {
+    channels[i] = mitigate_channel_create(m, nullptr);
+    session(channels[i], 1 << (10 + i));
+  }
+
+  for (int left = sessions_left; left > 0; left = sessions_left) {
+    sessions_left.wait(left);
+  }
+  for (int i = 0; i < nsessions; i++) {
+    mitigate_channel_destroy(channels[i]);
+  }
+  mitigate_destroy(m);
+  return 0;
+}
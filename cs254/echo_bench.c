@@ -0,0 +1,132 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// libmitigate-preload.so benchmark: runs the unmodified echo-server plain,
+// preloaded with only another port selected (the cost on unselected
+// descriptors) and preloaded with its own port selected, and times
+// sequential round trips against each.
+//
+// Usage: echo-bench [requests] [q_ms] [port]
+
+static long long now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return (x > y) - (x < y);
+}
+
+static pid_t start_server(int port, const char *preload, const char *addr,
+                          const char *q_ms) {
+  char port_arg[16];
+  snprintf(port_arg, sizeof(port_arg), "%d", port);
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (preload != NULL) {
+      setenv("LD_PRELOAD", preload, 1);
+      setenv("MITIGATE_ADDR", addr, 1);
+      setenv("MITIGATE_Q_MS", q_ms, 1);
+    }
+    execl("./echo-server", "echo-server", port_arg, (char *)NULL);
+    perror("Failed to start ./echo-server");
+    _exit(1);
+  }
+  return pid;
+}
+
+static int connect_server(int port) {
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(port),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  // The server may still be starting up
+  for (int tries = 0; tries < 100; tries++) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      int one = 1;
+      setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      return sock;
+    }
+    close(sock);
+    struct timespec wait = {0, 10000000};
+    nanosleep(&wait, NULL);
+  }
+  return -1;
+}
+
+static void run(const char *name, int port, const char *preload,
+                const char *addr, const char *q_ms, int requests) {
+  pid_t server = start_server(port, preload, addr, q_ms);
+  int sock = connect_server(port);
+  if (sock < 0) {
+    perror("Failed to connect to echo-server");
+    exit(1);
+  }
+
+  long long *rtt = malloc(requests * sizeof(*rtt));
+  char msg[64];
+  memset(msg, 'x', sizeof(msg));
+  long long start = now_ns();
+  int done = 0; // round trips completed, and timed in rtt
+  for (; done < requests; done++) {
+    long long sent = now_ns();
+    if (write(sock, msg, sizeof(msg)) != sizeof(msg)) {
+      fprintf(stderr, "Short write to echo-server after %d round trips\n",
+              done);
+      break;
+    }
+    for (size_t got = 0; got < sizeof(msg);) {
+      ssize_t n = read(sock, msg, sizeof(msg) - got);
+      if (n <= 0) {
+        fprintf(stderr, "echo-server went away\n");
+        exit(1);
+      }
+      got += n;
+    }
+    rtt[done] = now_ns() - sent;
+  }
+  double seconds = (now_ns() - start) / 1e9;
+  close(sock);
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+
+  if (done == 0) {
+    printf("%-10s %10s\n", name, "-");
+    free(rtt);
+    return;
+  }
+  qsort(rtt, done, sizeof(*rtt), cmp_ll);
+  printf("%-10s %10.0f %10lld %10lld %10lld\n", name, done / seconds,
+         rtt[done / 2] / 1000, rtt[done * 99 / 100] / 1000,
+         rtt[done - 1] / 1000);
+  free(rtt);
+}
+
+int main(int argc, char *argv[]) {
+  int requests = argc > 1 ? atoi(argv[1]) : 200;
+  const char *q_ms = argc > 2 ? argv[2] : "1";
+  int port = argc > 3 ? atoi(argv[3]) : 7007;
+  const char *preload = "./libmitigate-preload.so";
+  char own[16], other[16];
+  snprintf(own, sizeof(own), ":%d", port);
+  snprintf(other, sizeof(other), ":%d", port + 1);
+
+  printf("%d round trips of 64 bytes, q = %s ms, RTT in us\n", requests,
+         q_ms);
+  printf("%-10s %10s %10s %10s %10s\n", "server", "req/s", "p50", "p99",
+         "max");
+  run("plain", port, NULL, NULL, NULL, requests);
+  run("preloaded", port, preload, other, q_ms, requests);
+  run("mitigated", port, preload, own, q_ms, requests);
+  return 0;
+}
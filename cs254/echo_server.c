@@ -0,0 +1,38 @@
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Minimal TCP echo server on 127.0.0.1, one connection at a time. It knows
+// nothing of mitigation: echo-bench runs it with and without
+// libmitigate-preload.so.
+//
+// Usage: echo-server port
+
+int main(int argc, char *argv[]) {
+  int port = argc > 1 ? atoi(argv[1]) : 7007;
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(port),
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  int one = 1;
+  int lsock = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(lsock, 16) != 0) {
+    perror("echo-server");
+    return 1;
+  }
+  for (;;) {
+    int sock = accept(lsock, NULL, NULL);
+    if (sock < 0)
+      continue;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(sock, buf, sizeof(buf))) > 0) {
+      if (write(sock, buf, n) != n)
+        break;
+    }
+    close(sock);
+  }
+}
@@ -0,0 +1,138 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "release_timer.h"
+
+#define EVLOOP_BATCH 64
+
+// epoll data for the loop's own fds; watches are pointers, never these
+#define EVLOOP_TIMER 1
+#define EVLOOP_WAKE 2
+
+int evloop_init(struct evloop *ev, long long (*serve)(void *ctx), void *ctx) {
+  ev->serve = serve;
+  ev->ctx = ctx;
+  ev->armed = LLONG_MAX;
+  ev->retired = NULL;
+  ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+  ev->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  ev->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (ev->epfd < 0 || ev->timerfd < 0 || ev->wakefd < 0)
+    goto fail;
+
+  struct epoll_event timer_event = {.events = EPOLLIN,
+                                    .data.u64 = EVLOOP_TIMER};
+  struct epoll_event wake_event = {.events = EPOLLIN, .data.u64 = EVLOOP_WAKE};
+  if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->timerfd, &timer_event) != 0 ||
+      epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->wakefd, &wake_event) != 0)
+    goto fail;
+
+  // Serve once on the first dispatch so the timer gets armed
+  evloop_wake(ev);
+  return 0;
+
+fail:;
+  int saved = errno;
+  evloop_destroy(ev);
+  errno = saved;
+  return -1;
+}
+
+// Frees the watches evloop_unwatch has retired, once no batch can name them
+static void evloop_free_retired(struct evloop *ev) {
+  while (ev->retired != NULL) {
+    struct evloop_watch *w = ev->retired;
+    ev->retired = w->next_retired;
+    free(w);
+  }
+}
+
+void evloop_destroy(struct evloop *ev) {
+  evloop_free_retired(ev);
+  if (ev->wakefd >= 0)
+    close(ev->wakefd);
+  if (ev->timerfd >= 0)
+    close(ev->timerfd);
+  if (ev->epfd >= 0)
+    close(ev->epfd);
+  ev->wakefd = ev->timerfd = ev->epfd = -1;
+}
+
+void evloop_wake(struct evloop *ev) {
+  uint64_t one = 1;
+  // Only fails with EAGAIN when the counter is saturated, i.e. already rung
+  (void)!write(ev->wakefd, &one, sizeof(one));
+}
+
+struct evloop_watch *evloop_watch(struct evloop *ev, int fd, uint32_t events,
+                                  evloop_fn fn, void *ctx) {
+  struct evloop_watch *w = malloc(sizeof(*w));
+  if (w == NULL)
+    return NULL;
+  w->fd = fd;
+  w->fn = fn;
+  w->ctx = ctx;
+  w->next_retired = NULL;
+  struct epoll_event event = {.events = events, .data.ptr = w};
+  if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, fd, &event) != 0) {
+    free(w);
+    return NULL;
+  }
+  return w;
+}
+
+void evloop_unwatch(struct evloop *ev, struct evloop_watch *w) {
+  epoll_ctl(ev->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+  // The current batch may still hold an event for w, so free it afterwards
+  w->fn = NULL;
+  w->next_retired = ev->retired;
+  ev->retired = w;
+}
+
+static void evloop_arm(struct evloop *ev, long long deadline) {
+  if (deadline == ev->armed)
+    return;
+  // An all-zero it_value disarms the timer
+  struct itimerspec spec = {0};
+  if (deadline != LLONG_MAX) {
+    spec.it_value = release_timer_timespec(deadline);
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+      spec.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(ev->timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+  ev->armed = deadline;
+}
+
+int evloop_dispatch(struct evloop *ev, int timeout_ms) {
+  struct epoll_event events[EVLOOP_BATCH];
+  int n = epoll_wait(ev->epfd, events, EVLOOP_BATCH, timeout_ms);
+  if (n < 0)
+    return errno == EINTR ? 0 : -1;
+
+  uint64_t count;
+  for (int i = 0; i < n; i++) {
+    if (events[i].data.u64 == EVLOOP_TIMER) {
+      (void)!read(ev->timerfd, &count, sizeof(count));
+      ev->armed = LLONG_MAX; // an absolute timer fires once
+    } else if (events[i].data.u64 == EVLOOP_WAKE) {
+      (void)!read(ev->wakefd, &count, sizeof(count));
+    } else {
+      struct evloop_watch *w = events[i].data.ptr;
+      if (w->fn != NULL)
+        w->fn(w->fd, events[i].events, w->ctx);
+    }
+  }
+
+  evloop_free_retired(ev);
+
+  // Whatever woke us, deadlines may have passed or moved
+  if (n > 0)
+    evloop_arm(ev, ev->serve(ev->ctx));
+  return n;
+}
@@ -0,0 +1,54 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+
+// epoll-based release loop. One epoll set multiplexes a CLOCK_MONOTONIC
+// timerfd armed for the next release deadline, an eventfd that other threads
+// ring when the schedule changes, and any number of watched client fds. The
+// loop only wakes when one of those is due, and its epoll fd can itself be
+// added to another epoll set to embed the loop in an existing server.
+
+typedef void (*evloop_fn)(int fd, uint32_t events, void *ctx);
+
+struct evloop_watch {
+  int fd;
+  evloop_fn fn;
+  void *ctx;
+  struct evloop_watch *next_retired;
+};
+
+struct evloop {
+  int epfd;
+  int timerfd;
+  int wakefd;
+  long long armed; // deadline the timerfd is set for, LLONG_MAX if disarmed
+
+  // Serves whatever is due and returns the next deadline (LLONG_MAX for none)
+  long long (*serve)(void *ctx);
+  void *ctx;
+
+  // Watches removed during a dispatch, freed once its event batch is done
+  struct evloop_watch *retired;
+};
+
+// Returns 0, or -1 with errno set
+int evloop_init(struct evloop *ev, long long (*serve)(void *ctx), void *ctx);
+void evloop_destroy(struct evloop *ev);
+
+// Makes the next (or current) evloop_dispatch call serve again. Safe from any
+// thread.
+void evloop_wake(struct evloop *ev);
+
+// Calls fn(fd, events, ctx) from evloop_dispatch whenever fd has any of the
+// epoll events ready. Returns NULL with errno set on failure.
+struct evloop_watch *evloop_watch(struct evloop *ev, int fd, uint32_t events,
+                                  evloop_fn fn, void *ctx);
+void evloop_unwatch(struct evloop *ev, struct evloop_watch *w);
+
+// Waits up to timeout_ms (-1 for ever) for a deadline or event, handles
+// everything that is ready and rearms the timer. Returns the number of epoll
+// events handled, or -1 with errno set.
+int evloop_dispatch(struct evloop *ev, int timeout_ms);
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+
+#include "heap.h"
+
+static void heap_set(struct heap *h, unsigned int slot, struct sched_entry *e) {
+  h->items[slot] = e;
+  e->slot = slot;
+}
+
+static void heap_sift_up(struct heap *h, unsigned int slot) {
+  struct sched_entry *e = h->items[slot];
+  while (slot > 0) {
+    unsigned int parent = (slot - 1) / 2;
+    if (h->items[parent]->deadline <= e->deadline)
+      break;
+    heap_set(h, slot, h->items[parent]);
+    slot = parent;
+  }
+  heap_set(h, slot, e);
+}
+
+static void heap_sift_down(struct heap *h, unsigned int slot) {
+  struct sched_entry *e = h->items[slot];
+  while (1) {
+    unsigned int child = 2 * slot + 1;
+    if (child >= h->size)
+      break;
+    if (child + 1 < h->size &&
+        h->items[child + 1]->deadline < h->items[child]->deadline)
+      child++;
+    if (e->deadline <= h->items[child]->deadline)
+      break;
+    heap_set(h, slot, h->items[child]);
+    slot = child;
+  }
+  heap_set(h, slot, e);
+}
+
+int heap_init(struct heap *h, unsigned int capacity) {
+  if (capacity == 0)
+    capacity = 16;
+  h->items = malloc(capacity * sizeof(*h->items));
+  if (h->items == NULL)
+    return -1;
+  h->size = 0;
+  h->capacity = capacity;
+  return 0;
+}
+
+void heap_destroy(struct heap *h) {
+  free(h->items);
+  h->items = NULL;
+}
+
+int heap_push(struct heap *h, struct sched_entry *e) {
+  if (h->size == h->capacity) {
+    struct sched_entry **items =
+        realloc(h->items, 2 * h->capacity * sizeof(*h->items));
+    if (items == NULL)
+      return -1;
+    h->items = items;
+    h->capacity *= 2;
+  }
+  heap_set(h, h->size++, e);
+  heap_sift_up(h, e->slot);
+  return 0;
+}
+
+void heap_remove(struct heap *h, struct sched_entry *e) {
+  unsigned int slot = e->slot;
+  struct sched_entry *last = h->items[--h->size];
+  if (last == e)
+    return;
+  heap_set(h, slot, last);
+  heap_update(h, last);
+}
+
+void heap_update(struct heap *h, struct sched_entry *e) {
+  unsigned int slot = e->slot;
+  if (slot > 0 && h->items[(slot - 1) / 2]->deadline > e->deadline)
+    heap_sift_up(h, slot);
+  else
+    heap_sift_down(h, slot);
+}
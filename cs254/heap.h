@@ -0,0 +1,41 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+
+// Binary min-heap of release deadlines. Entries are embedded in the objects
+// they schedule (see container_of) and remember their own position, so a
+// reschedule or removal is O(log N) without searching.
+
+struct sched_entry {
+  long long deadline; // absolute CLOCK_MONOTONIC time, in ns
+  unsigned int slot;  // position in the heap or wheel, owned by it
+  struct sched_entry *next, *prev; // wheel slot list links
+};
+
+#define container_of(ptr, type, member)                                        \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct heap {
+  struct sched_entry **items;
+  unsigned int size;
+  unsigned int capacity;
+};
+
+// Returns 0, or -1 if the initial array could not be allocated
+int heap_init(struct heap *h, unsigned int capacity);
+void heap_destroy(struct heap *h);
+
+// Returns 0, or -1 if the heap could not grow
+int heap_push(struct heap *h, struct sched_entry *e);
+void heap_remove(struct heap *h, struct sched_entry *e);
+
+// Restores the heap after e->deadline changed
+void heap_update(struct heap *h, struct sched_entry *e);
+
+// Earliest deadline, or NULL if the heap is empty
+static inline struct sched_entry *heap_min(const struct heap *h) {
+  return h->size > 0 ? h->items[0] : NULL;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+#define LOGGER_BUF 4096 // formatted bytes gathered before a write
+
+struct log_buffer {
+  int fd;
+  size_t len;
+  char data[LOGGER_BUF];
+};
+
+static void log_buffer_flush(struct log_buffer *buf) {
+  size_t off = 0;
+  while (buf->fd >= 0 && off < buf->len) {
+    ssize_t n = write(buf->fd, buf->data + off, buf->len - off);
+    if (n <= 0)
+      break;
+    off += n;
+  }
+  buf->len = 0;
+}
+
+static void log_format(struct log_buffer *buf, const struct log_record *rec) {
+  // Leave room for the longest record formatted below
+  if (rec->fd != buf->fd || LOGGER_BUF - buf->len < 160) {
+    log_buffer_flush(buf);
+    buf->fd = rec->fd;
+  }
+  char *out = buf->data + buf->len;
+  size_t room = LOGGER_BUF - buf->len;
+  int n = 0;
+  switch (rec->kind) {
+  case LOG_RELEASE:
+    n = snprintf(out, room,
+                 "Time spent: %lld ns\n"
+                 "Release scheduled at %lld ns, actual %lld ns "
+                 "(late by %lld ns)\n",
+                 rec->v[0], rec->v[1], rec->v[2], rec->v[2] - rec->v[1]);
+    break;
+  case LOG_QUANTUM:
+    n = snprintf(out, room, "Channel %u q %s to %lld ns\n", rec->channel,
+                 rec->verb, rec->v[0]);
+    break;
+  }
+  if (n > 0)
+    buf->len += (size_t)n < room ? (size_t)n : room - 1;
+}
+
+static void *logger_writer(void *arg) {
+  struct logger *l = arg;
+  struct log_buffer buf = {.fd = -1};
+  unsigned int head = atomic_load_explicit(&l->head, memory_order_relaxed);
+
+  while (1) {
+    unsigned int tail = atomic_load_explicit(&l->tail, memory_order_acquire);
+    if (head == tail) {
+      log_buffer_flush(&buf);
+      pthread_mutex_lock(&l->lock);
+      l->flushed = head;
+      pthread_cond_broadcast(&l->written);
+      pthread_mutex_unlock(&l->lock);
+      if (atomic_load(&l->shutdown))
+        break;
+
+      // Announce the sleep, then look once more before blocking
+      atomic_store(&l->sleeping, 1);
+      atomic_thread_fence(memory_order_seq_cst);
+      if (head == atomic_load_explicit(&l->tail, memory_order_acquire) &&
+          !atomic_load(&l->shutdown)) {
+        uint64_t count;
+        (void)!read(l->wakefd, &count, sizeof(count));
+      }
+      atomic_store(&l->sleeping, 0);
+      continue;
+    }
+    while (head != tail) {
+      log_format(&buf, &l->records[head & l->mask]);
+      head++;
+      // Hand slots back as we go so a full ring drains without waiting
+      atomic_store_explicit(&l->head, head, memory_order_release);
+    }
+  }
+  return NULL;
+}
+
+int logger_init(struct logger *l, unsigned int capacity,
+                enum mitigate_log_overflow overflow) {
+  unsigned int size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  l->records = malloc(size * sizeof(*l->records));
+  l->wakefd = eventfd(0, EFD_CLOEXEC);
+  if (l->records == NULL || l->wakefd < 0) {
+    free(l->records);
+    if (l->wakefd >= 0)
+      close(l->wakefd);
+    return -1;
+  }
+  l->mask = size - 1;
+  l->overflow = overflow;
+  l->head_cache = 0;
+  l->dropped = 0;
+  l->flushed = 0;
+  atomic_init(&l->head, 0);
+  atomic_init(&l->tail, 0);
+  atomic_init(&l->sleeping, 0);
+  atomic_init(&l->shutdown, 0);
+  pthread_mutex_init(&l->lock, NULL);
+  pthread_cond_init(&l->written, NULL);
+  if (pthread_create(&l->thread, NULL, logger_writer, l) != 0) {
+    pthread_cond_destroy(&l->written);
+    pthread_mutex_destroy(&l->lock);
+    close(l->wakefd);
+    free(l->records);
+    return -1;
+  }
+  return 0;
+}
+
+void logger_destroy(struct logger *l) {
+  atomic_store(&l->shutdown, 1);
+  logger_wake(l);
+  pthread_join(l->thread, NULL);
+  pthread_cond_destroy(&l->written);
+  pthread_mutex_destroy(&l->lock);
+  close(l->wakefd);
+  free(l->records);
+}
+
+void logger_flush(struct logger *l) {
+  unsigned int tail = atomic_load_explicit(&l->tail, memory_order_acquire);
+  pthread_mutex_lock(&l->lock);
+  // The writer broadcasts each time it has written everything it saw
+  while ((int)(l->flushed - tail) < 0) {
+    pthread_cond_wait(&l->written, &l->lock);
+  }
+  pthread_mutex_unlock(&l->lock);
+}
+
+void logger_wake(struct logger *l) {
+  uint64_t one = 1;
+  (void)!write(l->wakefd, &one, sizeof(one));
+}
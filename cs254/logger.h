@@ -0,0 +1,90 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "mitigate.h"
+
+// Asynchronous release log. The release thread only copies a fixed-size
+// record of raw values into a lock-free single-producer ring; a writer thread
+// formats the records and writes them out, so console speed never shows up
+// in release jitter. When the writer falls behind, the mitigator's
+// log_overflow policy decides between dropping the record (counted) and
+// waiting for room.
+
+enum log_kind {
+  LOG_RELEASE, // v[0] time since last release, v[1] scheduled, v[2] actual
+  LOG_QUANTUM, // verb changed q to v[0]
+};
+
+struct log_record {
+  enum log_kind kind;
+  int fd; // where the line goes
+  unsigned int channel;
+  const char *verb; // static string from the policy
+  long long v[3];
+};
+
+struct logger {
+  // Producer side
+  _Alignas(64) atomic_uint tail;
+  unsigned int head_cache;
+  unsigned long long dropped;
+
+  // Writer side
+  _Alignas(64) atomic_uint head;
+  atomic_int sleeping; // writer is (about to be) blocked on wakefd
+
+  _Alignas(64) struct log_record *records;
+  unsigned int mask;
+  enum mitigate_log_overflow overflow;
+  int wakefd;
+  atomic_int shutdown;
+  pthread_t thread;
+
+  // For logger_flush only
+  pthread_mutex_t lock;
+  pthread_cond_t written;
+  unsigned int flushed; // records written out so far, under lock
+};
+
+// Starts the writer thread with room for at least capacity records.
+// Returns 0, or -1 on failure.
+int logger_init(struct logger *l, unsigned int capacity,
+                enum mitigate_log_overflow overflow);
+
+// Writes out whatever is still queued, then stops the writer
+void logger_destroy(struct logger *l);
+
+// Blocks until every record pushed so far has been written
+void logger_flush(struct logger *l);
+
+void logger_wake(struct logger *l);
+
+// Producer only. Returns 0, or -1 if the record was dropped.
+static inline int logger_push(struct logger *l, const struct log_record *rec) {
+  unsigned int tail = atomic_load_explicit(&l->tail, memory_order_relaxed);
+  while (tail - l->head_cache > l->mask) {
+    l->head_cache = atomic_load_explicit(&l->head, memory_order_acquire);
+    if (tail - l->head_cache <= l->mask)
+      break;
+    if (l->overflow == MITIGATE_LOG_DROP) {
+      l->dropped++;
+      return -1;
+    }
+    logger_wake(l);
+    sched_yield();
+  }
+  l->records[tail & l->mask] = *rec;
+  atomic_store_explicit(&l->tail, tail + 1, memory_order_release);
+
+  // Same handshake as channel parking: only a sleeping writer costs a write
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&l->sleeping, memory_order_relaxed))
+    logger_wake(l);
+  return 0;
+}
+
+#endif
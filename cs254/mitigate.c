@@ -0,0 +1,1336 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "logger.h"
+#include "mitigate.h"
+#include "pad.h"
+#include "policy.h"
+#include "pool.h"
+#include "quantile.h"
+#include "release_timer.h"
+#include "ring.h"
+#include "sandbox.h"
+#include "sched_backend.h"
+#include "slab.h"
+#include "trace.h"
+
+// Longest line the release thread formats for an int output
+#define LINE_MAX_LEN 64
+
+// Most iovecs one writev takes on Linux, for when limits.h hides IOV_MAX
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+struct mitigate_channel {
+  struct ring queue; // first, so it keeps its cache-line alignment
+  struct sched_entry entry;
+  struct release_timer timer;
+  struct policy_state policy;
+  struct policy_table table; // POLICY_TABLE on an initial_q of its own
+  struct mitigate_config cfg;
+  mitigator_t *m;
+  unsigned int id;
+  long long last_release;
+
+  // Release thread scratch for one slot: the outputs popped, lines formatted
+  // for int outputs, and the iovecs handed to a single write
+  unsigned int batch_limit;
+  struct mitigate_output *batch;
+  char (*lines)[LINE_MAX_LEN];
+  struct iovec *iov;
+  int out_not_socket; // sendmsg said ENOTSOCK, use writev from now on
+  // A slot's write that out_fd could not take whole: its iovecs still to go,
+  // from iov[unsent_iov], and the outputs not yet handed back
+  int unsent_iov, unsent_iovcnt;
+  unsigned int unsent_outputs;
+  int calibrated;     // initial_q follows the mitigator's learned quantum
+  long long last_queued; // queued_ns of the last output popped
+
+  // Producer side
+  atomic_ullong submitted;
+  struct slab payloads; // cfg.payload_size buffers, freed by the release thread
+
+  // mitigate_call handles, set up by the first call. Workers finish them in
+  // any order; call_run queues them in call order.
+  struct slab calls;
+  unsigned long long call_seq; // submitter only
+  pthread_mutex_t call_lock;
+  pthread_cond_t call_queued;      // call_next moved, for a waiting destroy
+  int call_waiting;                // destroy is waiting, under call_lock
+  unsigned long long call_next;    // next seq to queue, under call_lock
+  mitigate_request_t **call_early; // finished ahead of call_next, by seq
+  atomic_int call_fd;              // eventfd, -1 until asked for
+
+  // Set by the release thread when it takes the idle channel off the
+  // schedule; whoever swaps it back to 0 puts the channel back
+  atomic_int parked;
+  int scheduled; // on m->schedule, under the mitigator lock
+
+  // Copies of epochs and q for producer-side tracing, written by the release
+  // thread whenever q changes
+  atomic_ullong epoch_now;
+  atomic_llong q_now;
+
+  // Release thread side, read by others under the mitigator lock
+  unsigned long long released;
+  unsigned long long release_slots;
+  unsigned long long idle_ticks;
+  unsigned long long epochs;
+  unsigned long long parks;
+  unsigned long long write_errors;
+  unsigned long long blocked_slots;
+  unsigned long long throttled;
+  long long window_start;           // of the current leakage budget window
+  unsigned long long window_epochs; // epochs before it
+};
+
+struct mitigate_request {
+  struct pool_job job; // pool queue, then the mitigator's done list
+  mitigate_channel_t *ch;
+  int (*fn)(int);
+  int arg;
+  int (*fn_ctx)(void *arg); // mitigate_call_ctx, instead of fn
+  void *arg_ctx;
+  mitigate_done_fn done;
+  void *ctx;
+  unsigned long long seq;
+  int output;
+  atomic_int complete;
+};
+
+struct mitigate_classes {
+  unsigned int nclasses;
+  mitigate_channel_t *channels[];
+};
+
+struct mitigator {
+  struct mitigate_config cfg;
+  struct pool *workers;
+  struct sandbox *sandbox; // NULL unless cfg.sandbox_workers is set
+  struct policy_table table; // POLICY_TABLE only, else no levels
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;    // schedule changed or shutdown, MITIGATE_LOOP_THREAD
+  pthread_cond_t drained; // a channel's queue ran empty, for drainers
+  struct sched schedule;  // channels keyed on their next release slot
+  unsigned int next_id;
+  atomic_int shutdown;
+  int has_thread;
+  pthread_t release_thread;
+  struct evloop loop; // event loop modes
+  struct logger log;  // fed by the release thread under the lock
+  struct trace *trace; // NULL unless cfg.trace_path is set
+
+  // Padding: a copy of cfg.pad_buckets and one shared run of zeros as long as
+  // the largest bucket, which every padding iovec points into
+  size_t pad_buckets[PAD_MAX_BUCKETS];
+  unsigned int pad_nbuckets;
+  char *pad_zeros;
+  struct mitigate_pad_stats pad[PAD_MAX_BUCKETS];
+
+  unsigned long long ticks;
+  unsigned long long lateness[MITIGATE_LATENESS_BUCKETS];
+
+  // Released calls whose done callback is still to run, oldest first
+  struct pool_job *done;
+  struct pool_job *done_tail;
+  int done_running; // the loop is running a detached done list
+
+  // Calibration, when cfg.q_percentile is set
+  pthread_mutex_t calib_lock;
+  struct p2_sketch calib;
+  atomic_llong q_learned; // rounded estimate, 0 until the first sample
+};
+
+void mitigate_config_init(struct mitigate_config *cfg) {
+  cfg->initial_q = NSEC_PER_SEC / 10;
+  cfg->max_q = 16 * NSEC_PER_SEC;
+  cfg->change_threshold = 2;
+  cfg->queue_capacity = 1024;
+  cfg->queue_overflow = MITIGATE_QUEUE_BLOCK;
+  cfg->nworkers = 0;
+  cfg->log_releases = 1;
+  cfg->scheduler = MITIGATE_SCHED_HEAP;
+  cfg->wheel_tick_ns = 10000;
+  cfg->loop = MITIGATE_LOOP_THREAD;
+  cfg->park_idle = 1;
+  cfg->batch = 1;
+  cfg->out_fd = STDOUT_FILENO;
+  cfg->log_fd = STDOUT_FILENO;
+  cfg->payload_size = 0;
+  cfg->log_capacity = 4096;
+  cfg->log_overflow = MITIGATE_LOG_DROP;
+  cfg->trace_path = NULL;
+  cfg->trace_segment_records = 1 << 16;
+  cfg->trace_segments = 4;
+  cfg->pad_buckets = NULL;
+  cfg->pad_nbuckets = 0;
+  cfg->max_calls = 1024;
+  cfg->sandbox_workers = 0;
+  cfg->sandbox_timeout_ns = NSEC_PER_SEC;
+  cfg->q_percentile = 0;
+  cfg->leak_budget_bits = 0;
+  cfg->leak_window_ns = NSEC_PER_SEC;
+  cfg->policy_path = NULL;
+  cfg->policy_text = NULL;
+}
+
+// POLICY_TABLE's schedule for cfg. A table's quanta are fixed when it is
+// compiled, so they cannot follow a calibrated initial_q.
+static int mitigator_table_compile(struct policy_table *t,
+                                   const struct mitigate_config *cfg,
+                                   char *err, size_t errlen) {
+  if (cfg->q_percentile > 0) {
+    snprintf(err, errlen, "q_percentile is not supported by the %s policy",
+             POLICY_NAME);
+    return -1;
+  }
+  return policy_table_compile(t, cfg->policy_path, cfg->policy_text, cfg, err,
+                              errlen);
+}
+
+int mitigate_policy_check(const struct mitigate_config *cfg, char *err,
+                          size_t errlen) {
+  if (MITIGATE_POLICY != POLICY_TABLE)
+    return 0;
+  struct policy_table table;
+  if (mitigator_table_compile(&table, cfg, err, errlen) != 0)
+    return -1;
+  policy_table_free(&table);
+  return 0;
+}
+
+// Feeds one evaluation's duration into the sketch; any thread
+static void mitigator_calibrate(mitigator_t *m, long long ns) {
+  if (m->cfg.q_percentile <= 0 || ns < 0)
+    return;
+  pthread_mutex_lock(&m->calib_lock);
+  p2_add(&m->calib, ns);
+  long long q = policy_quantize(p2_value(&m->calib));
+  pthread_mutex_unlock(&m->calib_lock);
+  atomic_store_explicit(&m->q_learned, q, memory_order_relaxed);
+}
+
+// Tells the release loop the schedule changed or it should stop
+static void mitigator_wake(mitigator_t *m) {
+  if (m->cfg.loop == MITIGATE_LOOP_THREAD)
+    pthread_cond_signal(&m->wake);
+  else
+    evloop_wake(&m->loop);
+}
+
+const char *mitigate_policy_name(void) { return POLICY_NAME; }
+
+// After an idle tick the policy has settled: parks the channel unless an
+// output arrived meanwhile. Returns 1 if the channel is now parked.
+static int channel_park(mitigate_channel_t *ch) {
+  atomic_store(&ch->parked, 1);
+  // Pairs with the fence in mitigate_submit: either we see the new output
+  // or the producer sees parked
+  atomic_thread_fence(memory_order_seq_cst);
+  if (ring_size(&ch->queue) > 0 && atomic_exchange(&ch->parked, 0) == 1)
+    return 0;
+  // Either still empty, or the producer already claimed the unpark and will
+  // reschedule the channel once it gets the lock
+  ch->parks++;
+  return 1;
+}
+
+// Puts a parked channel back on the schedule at the first slot it would
+// have reached by now, replaying the idle ticks it slept through. The policy
+// had settled, so replaying them only means counting them. Called with the
+// mitigator lock held.
+static void channel_unpark(mitigate_channel_t *ch) {
+  mitigator_t *m = ch->m;
+  long long now = release_timer_now_ns();
+  long long q = ch->policy.q;
+  if (ch->timer.deadline_ns < now) {
+    long long skipped = (now - ch->timer.deadline_ns - 1) / q + 1;
+    ch->idle_ticks += skipped;
+    release_timer_advance(&ch->timer, skipped * q);
+  }
+  ch->entry.deadline = ch->timer.deadline_ns;
+  sched_insert(&m->schedule, &ch->entry);
+  ch->scheduled = 1;
+  mitigator_wake(m);
+}
+
+// Points iov at output i of the slot being released: the producer's own
+// buffer, or a line formatted into the channel's scratch for an int output
+static void channel_output_iov(mitigate_channel_t *ch, unsigned int i,
+                               struct iovec *iov) {
+  const struct mitigate_output *out = &ch->batch[i];
+  if (out->data != NULL) {
+    // Zero-copy: the iovec points at the producer's own buffer
+    iov->iov_base = (void *)out->data;
+    iov->iov_len = out->len;
+    return;
+  }
+  int len = snprintf(ch->lines[i], LINE_MAX_LEN, "Channel %u output: %d\n",
+                     ch->id, out->value);
+  iov->iov_base = ch->lines[i];
+  iov->iov_len = len < LINE_MAX_LEN ? len : LINE_MAX_LEN - 1;
+}
+
+// Pads an output of len bytes up to its bucket with an iovec into the shared
+// zeros. Returns 1 if it added that iovec at iov, 0 if none was needed.
+static int mitigator_pad(mitigator_t *m, size_t len, struct iovec *iov) {
+  if (m->pad_nbuckets == 0)
+    return 0;
+  unsigned int b = pad_bucket(m->pad_buckets, m->pad_nbuckets, len);
+  size_t pad = pad_length(m->pad_buckets, m->pad_nbuckets, len);
+  m->pad[b].outputs++;
+  m->pad[b].payload_bytes += len;
+  m->pad[b].padded_bytes += len + pad;
+  if (pad == 0)
+    return 0;
+  iov->iov_base = m->pad_zeros;
+  iov->iov_len = pad;
+  return 1;
+}
+
+// Writes the slot's iovecs still unsent to out_fd without blocking, picking
+// up after partial writes. Sockets get sendmsg with MSG_NOSIGNAL, so a peer
+// that went away is an error rather than SIGPIPE, and MSG_DONTWAIT; other
+// fds are polled first (see out_fd). Returns 0 once everything is written,
+// 1 if out_fd is full and the rest has to wait, or -1 if out_fd failed.
+static int channel_write(mitigate_channel_t *ch) {
+  int fd = ch->cfg.out_fd;
+  while (ch->unsent_iovcnt > 0) {
+    struct iovec *iov = &ch->iov[ch->unsent_iov];
+    ssize_t n;
+    if (!ch->out_not_socket) {
+      struct msghdr msg = {.msg_iov = iov, .msg_iovlen = ch->unsent_iovcnt};
+      n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n < 0 && errno == ENOTSOCK) {
+        ch->out_not_socket = 1;
+        continue;
+      }
+    } else {
+      struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+      if (poll(&pfd, 1, 0) == 0)
+        return 1;
+      n = writev(fd, iov, ch->unsent_iovcnt);
+    }
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+    }
+    while (ch->unsent_iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      ch->unsent_iov++;
+      ch->unsent_iovcnt--;
+    }
+    if (ch->unsent_iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+// Hands a written or dropped output back to its producer
+static void output_release(const struct mitigate_output *out) {
+  if (out->release != NULL)
+    out->release(out);
+}
+
+// Goes on with the last slot's write, and once it is done or out_fd has
+// failed, returns that slot's outputs to their producers. Returns 1 while
+// out_fd is still too full to take the rest.
+static int channel_finish_write(mitigate_channel_t *ch) {
+  int rc = channel_write(ch);
+  if (rc == 1)
+    return 1;
+  if (rc < 0) {
+    ch->write_errors++;
+    ch->unsent_iovcnt = 0;
+  }
+  for (unsigned int i = 0; i < ch->unsent_outputs; i++) {
+    output_release(&ch->batch[i]);
+  }
+  ch->unsent_outputs = 0;
+  return 0;
+}
+
+// Writes the slot's n outputs, iovcnt iovecs with their padding, to out_fd in
+// one go, then returns them to their producers; if out_fd is full, the rest
+// of the write and the outputs wait for the channel's next slot
+static void channel_flush(mitigate_channel_t *ch, unsigned int n, int iovcnt) {
+  ch->unsent_iov = 0;
+  ch->unsent_iovcnt = ch->cfg.out_fd >= 0 ? iovcnt : 0;
+  ch->unsent_outputs = n;
+  channel_finish_write(ch);
+}
+
+// Hands a log record to the writer thread; never formats or writes here
+static void channel_log(mitigate_channel_t *ch, const struct log_record *rec) {
+  if (ch->cfg.log_releases && ch->cfg.log_fd >= 0)
+    logger_push(&ch->m->log, rec);
+}
+
+// Each epoch's share of leakage_bits: which of the released + 1 points it
+// ended at, and which of the levels a quantum chosen from timings took
+static double channel_epoch_bits(const mitigate_channel_t *ch) {
+  double bits = log2(ch->released + 1.0);
+  if (ch->calibrated || POLICY_OBSERVES)
+    bits += log2(MITIGATE_CALIBRATION_LEVELS);
+  return bits;
+}
+
+// Whether the leakage budget lets the policy's change from old_q stand, for
+// a slot at now. Moves the budget window along first.
+static int channel_budget_allows(mitigate_channel_t *ch, long long old_q,
+                                 long long now) {
+  long long window = ch->cfg.leak_window_ns;
+  if (window > 0 && now - ch->window_start >= window) {
+    ch->window_start += (now - ch->window_start) / window * window;
+    ch->window_epochs = ch->epochs;
+  }
+  double budget = ch->cfg.leak_budget_bits;
+  if (budget <= 0)
+    return 1;
+  double epoch_bits = channel_epoch_bits(ch);
+  double spent = (ch->epochs - ch->window_epochs) * epoch_bits;
+  if (spent + epoch_bits > budget)
+    return 0;
+  // Past half the budget, only keep to the more conservative quanta
+  return spent <= budget / 2 || ch->policy.q >= old_q;
+}
+
+// Serves the channel's current slot: releases up to the policy's batch limit
+// of outputs, all taken from the queue at once and written in one go, or
+// records an idle tick. Then lets the policy adjust q once for the slot
+// and moves the channel on to its next slot.
+// Returns 1 if the channel parked instead of staying on the schedule.
+// Called by the release thread with the mitigator lock held.
+static int channel_tick(mitigate_channel_t *ch, long long now) {
+  mitigator_t *m = ch->m;
+  struct release_timer *timer = &ch->timer;
+  timer->actual_ns = now;
+
+  long long late_us = release_timer_lateness_ns(timer) / 1000;
+  if (late_us < 0)
+    late_us = 0;
+  if (late_us >= MITIGATE_LATENESS_BUCKETS)
+    late_us = MITIGATE_LATENESS_BUCKETS - 1;
+  m->lateness[late_us]++;
+  m->ticks++;
+
+  // The rest of a write out_fd could not take goes before anything new, so
+  // bytes still leave in order and only on release slots. Until it has, the
+  // slot neither releases nor changes q.
+  if (ch->unsent_outputs > 0 && channel_finish_write(ch)) {
+    ch->blocked_slots++;
+    ch->entry.deadline = release_timer_advance(timer, ch->policy.q);
+    return 0;
+  }
+
+  const char *change;
+  int iovcnt = 0;
+  unsigned int limit = policy_batch_limit(&ch->policy, &ch->cfg);
+  if (limit > ch->batch_limit)
+    limit = ch->batch_limit;
+  // initial_q is only read when a new epoch starts, so it can follow the
+  // learned quantum at any time
+  if (ch->calibrated) {
+    long long learned =
+        atomic_load_explicit(&m->q_learned, memory_order_relaxed);
+    if (learned > 0)
+      ch->cfg.initial_q = learned;
+  }
+  unsigned int n = ring_pop_batch(&ch->queue, ch->batch, limit);
+  int idle = n == 0;
+  if (POLICY_OBSERVES) {
+    for (unsigned int i = 0; i < n; i++) {
+      policy_observe(&ch->policy, ch->batch[i].queued_ns - ch->last_queued,
+                     &ch->cfg);
+      ch->last_queued = ch->batch[i].queued_ns;
+    }
+  }
+  // To put back if the budget refuses what the policy does with this slot
+  struct policy_state before = ch->policy;
+  if (idle) {
+    ch->idle_ticks++;
+    change = policy_idle(&ch->policy, &ch->cfg);
+  } else {
+    ch->released += n;
+    ch->release_slots++;
+    for (unsigned int i = 0; i < n; i++) {
+      struct iovec *iov = &ch->iov[iovcnt++];
+      channel_output_iov(ch, i, iov);
+      iovcnt += mitigator_pad(m, iov->iov_len, &ch->iov[iovcnt]);
+    }
+    channel_flush(ch, n, iovcnt);
+    struct log_record rec = {
+        .kind = LOG_RELEASE,
+        .fd = ch->cfg.log_fd,
+        .channel = ch->id,
+        .v = {timer->actual_ns - ch->last_release,
+              timer->deadline_ns - timer->start_ns,
+              timer->actual_ns - timer->start_ns},
+    };
+    channel_log(ch, &rec);
+    ch->last_release = timer->actual_ns;
+    unsigned int pending = ring_size(&ch->queue);
+    if (m->trace != NULL)
+      trace_emit(m->trace, TRACE_RELEASE, now, ch->id, ch->epochs,
+                 ch->policy.q, pending, n);
+    change = policy_released(&ch->policy, pending, &ch->cfg);
+    if (pending == 0)
+      pthread_cond_broadcast(&m->drained);
+  }
+  if (change != NULL && !channel_budget_allows(ch, before.q, now)) {
+    ch->policy = before;
+    ch->throttled++;
+    change = NULL;
+  }
+  // One epoch per quantum change, however many outputs the slot carried
+  if (change != NULL) {
+    ch->epochs++;
+    atomic_store_explicit(&ch->epoch_now, ch->epochs, memory_order_relaxed);
+    atomic_store_explicit(&ch->q_now, ch->policy.q, memory_order_relaxed);
+    if (m->trace != NULL)
+      trace_emit(m->trace, TRACE_QUANTUM, now, ch->id, ch->epochs,
+                 ch->policy.q, ring_size(&ch->queue), 0);
+    struct log_record rec = {
+        .kind = LOG_QUANTUM,
+        .fd = ch->cfg.log_fd,
+        .channel = ch->id,
+        .verb = change,
+        .v = {ch->policy.q},
+    };
+    channel_log(ch, &rec);
+  }
+
+  ch->entry.deadline = release_timer_advance(timer, ch->policy.q);
+  return idle && ch->cfg.park_idle &&
+         policy_idle_settled(&ch->policy, &ch->cfg) && channel_park(ch);
+}
+
+static void call_finish(mitigate_request_t *req);
+
+// Runs the done callbacks of the calls released since the last time, with
+// the mitigator unlocked. Called by the release loop with the lock held, and
+// returns with it held. Returns 1 if there were any.
+static int mitigator_run_done(mitigator_t *m) {
+  struct pool_job *job = m->done;
+  if (job == NULL)
+    return 0;
+  m->done = m->done_tail = NULL;
+  m->done_running = 1;
+  pthread_mutex_unlock(&m->lock);
+  while (job != NULL) {
+    struct pool_job *next = job->next; // done may free the request
+    call_finish(container_of(job, mitigate_request_t, job));
+    job = next;
+  }
+  pthread_mutex_lock(&m->lock);
+  m->done_running = 0;
+  pthread_cond_broadcast(&m->drained); // for channel_calls_settle
+  return 1;
+}
+
+// Serves every channel whose slot has come and reschedules it. Returns when
+// the release loop should look again, LLONG_MAX if no channel is scheduled.
+// Called with the mitigator lock held.
+static long long serve_due_locked(mitigator_t *m) {
+  while (1) {
+    long long now = release_timer_now_ns();
+    struct sched_entry *due = sched_due(&m->schedule, now);
+    if (due == NULL)
+      return sched_next_wakeup(&m->schedule);
+    mitigate_channel_t *ch = container_of(due, mitigate_channel_t, entry);
+    if (channel_tick(ch, now)) {
+      sched_remove(&m->schedule, due);
+      ch->scheduled = 0;
+    } else {
+      sched_reschedule(&m->schedule, due);
+    }
+  }
+}
+
+// evloop serve callback
+static long long serve_due(void *arg) {
+  mitigator_t *m = arg;
+  pthread_mutex_lock(&m->lock);
+  long long wakeup = serve_due_locked(m);
+  while (mitigator_run_done(m)) {
+    wakeup = serve_due_locked(m);
+  }
+  pthread_mutex_unlock(&m->lock);
+  return wakeup;
+}
+
+// Release thread for MITIGATE_LOOP_EPOLL
+static void *q_interval_epoll(void *arg) {
+  mitigator_t *m = arg;
+  while (!atomic_load(&m->shutdown)) {
+    evloop_dispatch(&m->loop, -1);
+  }
+  return NULL;
+}
+
+// Release thread: sleeps until the earliest channel deadline, serves it and
+// reschedules it, for every channel of the mitigator
+static void *q_interval(void *arg) {
+  mitigator_t *m = arg;
+  pthread_mutex_lock(&m->lock);
+  while (!atomic_load(&m->shutdown)) {
+    // Woken early if a channel is added, removed or we shut down
+    long long wakeup = serve_due_locked(m);
+    if (mitigator_run_done(m))
+      continue; // time has passed, serve again before sleeping
+    if (wakeup == LLONG_MAX) {
+      pthread_cond_wait(&m->wake, &m->lock);
+    } else {
+      struct timespec deadline = release_timer_timespec(wakeup);
+      pthread_cond_timedwait(&m->wake, &m->lock, &deadline);
+    }
+  }
+  pthread_mutex_unlock(&m->lock);
+  return NULL;
+}
+
+// Copies the bucket set and maps the zeros padding is taken from. Returns 0,
+// or -1 if the buckets are unusable or the zeros could not be mapped.
+static int mitigator_pad_init(mitigator_t *m,
+                              const struct mitigate_config *cfg) {
+  if (pad_check(cfg->pad_buckets, cfg->pad_nbuckets) != 0)
+    return -1;
+  size_t largest = cfg->pad_buckets[cfg->pad_nbuckets - 1];
+  void *zeros = mmap(NULL, largest, PROT_READ,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (zeros == MAP_FAILED)
+    return -1;
+  memcpy(m->pad_buckets, cfg->pad_buckets,
+         cfg->pad_nbuckets * sizeof(*cfg->pad_buckets));
+  m->pad_nbuckets = cfg->pad_nbuckets;
+  m->pad_zeros = zeros;
+  return 0;
+}
+
+static void mitigator_pad_destroy(mitigator_t *m) {
+  if (m->pad_zeros != NULL)
+    munmap(m->pad_zeros, m->pad_buckets[m->pad_nbuckets - 1]);
+}
+
+mitigator_t *mitigate_create(const struct mitigate_config *cfg) {
+  mitigator_t *m = aligned_alloc(64, sizeof(*m)); // for the logger's rings
+  if (m == NULL)
+    return NULL;
+  memset(m, 0, sizeof(*m));
+  m->cfg = *cfg;
+  if (MITIGATE_POLICY == POLICY_TABLE) {
+    char err[256];
+    if (mitigator_table_compile(&m->table, cfg, err, sizeof(err)) != 0) {
+      free(m);
+      errno = EINVAL;
+      return NULL;
+    }
+    m->cfg.initial_q = m->table.levels[0].q;
+    if (m->table.batch > 0)
+      m->cfg.batch = m->table.batch;
+  }
+
+  enum sched_backend backend =
+      cfg->scheduler == MITIGATE_SCHED_WHEEL ? SCHED_WHEEL : SCHED_HEAP;
+  if (sched_init(&m->schedule, backend, cfg->wheel_tick_ns,
+                 release_timer_now_ns()) != 0) {
+    policy_table_free(&m->table);
+    free(m);
+    return NULL;
+  }
+  // Fork the sandbox before any thread exists
+  if (cfg->sandbox_workers > 0) {
+    m->sandbox = sandbox_create(cfg->sandbox_workers, cfg->sandbox_timeout_ns);
+    if (m->sandbox == NULL) {
+      sched_destroy(&m->schedule);
+      policy_table_free(&m->table);
+      free(m);
+      return NULL;
+    }
+  }
+  m->workers = pool_create(cfg->nworkers);
+  if (m->workers == NULL) {
+    if (m->sandbox != NULL)
+      sandbox_destroy(m->sandbox);
+    sched_destroy(&m->schedule);
+    policy_table_free(&m->table);
+    free(m);
+    return NULL;
+  }
+  if (logger_init(&m->log, cfg->log_capacity, cfg->log_overflow) != 0) {
+    pool_destroy(m->workers);
+    if (m->sandbox != NULL)
+      sandbox_destroy(m->sandbox);
+    sched_destroy(&m->schedule);
+    policy_table_free(&m->table);
+    free(m);
+    return NULL;
+  }
+  if (cfg->pad_nbuckets > 0 && mitigator_pad_init(m, cfg) != 0) {
+    logger_destroy(&m->log);
+    pool_destroy(m->workers);
+    if (m->sandbox != NULL)
+      sandbox_destroy(m->sandbox);
+    sched_destroy(&m->schedule);
+    policy_table_free(&m->table);
+    free(m);
+    return NULL;
+  }
+  if (cfg->trace_path != NULL) {
+    m->trace = trace_open(cfg->trace_path, cfg->trace_segment_records,
+                          cfg->trace_segments);
+    if (m->trace == NULL) {
+      mitigator_pad_destroy(m);
+      logger_destroy(&m->log);
+      pool_destroy(m->workers);
+      if (m->sandbox != NULL)
+        sandbox_destroy(m->sandbox);
+      sched_destroy(&m->schedule);
+      policy_table_free(&m->table);
+      free(m);
+      return NULL;
+    }
+  }
+
+  // Deadlines are CLOCK_MONOTONIC, so the timed waits must be too
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&m->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&m->drained, NULL);
+  pthread_mutex_init(&m->lock, NULL);
+  atomic_init(&m->shutdown, 0);
+  pthread_mutex_init(&m->calib_lock, NULL);
+  p2_init(&m->calib, cfg->q_percentile);
+  atomic_init(&m->q_learned, 0);
+
+  if (cfg->loop != MITIGATE_LOOP_THREAD &&
+      evloop_init(&m->loop, serve_due, m) != 0)
+    goto fail;
+  if (cfg->loop != MITIGATE_LOOP_EMBEDDED) {
+    void *(*thread_fn)(void *) =
+        cfg->loop == MITIGATE_LOOP_EPOLL ? q_interval_epoll : q_interval;
+    if (pthread_create(&m->release_thread, NULL, thread_fn, m) != 0) {
+      if (cfg->loop != MITIGATE_LOOP_THREAD)
+        evloop_destroy(&m->loop);
+      goto fail;
+    }
+    m->has_thread = 1;
+  }
+  return m;
+
+fail:
+  pthread_mutex_destroy(&m->calib_lock);
+  pthread_mutex_destroy(&m->lock);
+  pthread_cond_destroy(&m->drained);
+  pthread_cond_destroy(&m->wake);
+  if (m->trace != NULL)
+    trace_close(m->trace);
+  mitigator_pad_destroy(m);
+  logger_destroy(&m->log);
+  pool_destroy(m->workers);
+  if (m->sandbox != NULL)
+    sandbox_destroy(m->sandbox);
+  sched_destroy(&m->schedule);
+  policy_table_free(&m->table);
+  free(m);
+  return NULL;
+}
+
+void mitigate_destroy(mitigator_t *m) {
+  pthread_mutex_lock(&m->lock);
+  atomic_store(&m->shutdown, 1);
+  mitigator_wake(m);
+  pthread_mutex_unlock(&m->lock);
+  if (m->has_thread)
+    pthread_join(m->release_thread, NULL);
+  if (m->cfg.loop != MITIGATE_LOOP_THREAD)
+    evloop_destroy(&m->loop);
+  logger_destroy(&m->log); // writes out whatever the loop logged last
+  if (m->trace != NULL)
+    trace_close(m->trace);
+  mitigator_pad_destroy(m);
+
+  pthread_mutex_destroy(&m->calib_lock);
+  pthread_mutex_destroy(&m->lock);
+  pthread_cond_destroy(&m->drained);
+  pthread_cond_destroy(&m->wake);
+  pool_destroy(m->workers);
+  if (m->sandbox != NULL)
+    sandbox_destroy(m->sandbox);
+  sched_destroy(&m->schedule);
+  policy_table_free(&m->table);
+  free(m);
+}
+
+void mitigate_stats(mitigator_t *m, struct mitigate_stats *stats) {
+  pthread_mutex_lock(&m->lock);
+  stats->ticks = m->ticks;
+  stats->log_dropped = m->log.dropped;
+  memset(stats->pad, 0, sizeof(stats->pad));
+  memcpy(stats->pad, m->pad, m->pad_nbuckets * sizeof(*m->pad));
+  for (unsigned int i = 0; i < m->pad_nbuckets; i++) {
+    stats->pad[i].size = m->pad_buckets[i];
+  }
+  memcpy(stats->lateness, m->lateness, sizeof(stats->lateness));
+  pthread_mutex_unlock(&m->lock);
+  stats->sandbox_restarts =
+      m->sandbox != NULL ? sandbox_restarts(m->sandbox) : 0;
+  stats->learned_q = atomic_load(&m->q_learned);
+
+  clockid_t clock;
+  struct timespec ts;
+  stats->release_cpu_ns = 0;
+  if (m->has_thread && pthread_getcpuclockid(m->release_thread, &clock) == 0 &&
+      clock_gettime(clock, &ts) == 0)
+    stats->release_cpu_ns = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+long long mitigate_lateness_percentile(const struct mitigate_stats *stats,
+                                       double p) {
+  unsigned long long total = 0;
+  for (int i = 0; i < MITIGATE_LATENESS_BUCKETS; i++) {
+    total += stats->lateness[i];
+  }
+  unsigned long long rank = (unsigned long long)(p * total);
+  unsigned long long seen = 0;
+  for (int i = 0; i < MITIGATE_LATENESS_BUCKETS; i++) {
+    seen += stats->lateness[i];
+    if (seen > rank || (seen == total && seen > 0))
+      return (i + 1) * 1000LL;
+  }
+  return 0;
+}
+
+int mitigate_loop_fd(mitigator_t *m) {
+  return m->cfg.loop == MITIGATE_LOOP_THREAD ? -1 : m->loop.epfd;
+}
+
+int mitigate_loop_dispatch(mitigator_t *m, int timeout_ms) {
+  return evloop_dispatch(&m->loop, timeout_ms);
+}
+
+mitigate_watch_t *mitigate_loop_watch(mitigator_t *m, int fd,
+                                      unsigned int events,
+                                      void (*fn)(int fd, unsigned int events,
+                                                 void *ctx),
+                                      void *ctx) {
+  if (m->cfg.loop == MITIGATE_LOOP_THREAD)
+    return NULL;
+  return evloop_watch(&m->loop, fd, events, fn, ctx);
+}
+
+void mitigate_loop_unwatch(mitigator_t *m, mitigate_watch_t *w) {
+  evloop_unwatch(&m->loop, w);
+}
+
+static void channel_free(mitigate_channel_t *ch) {
+  // Outputs out_fd never took whole are dropped like queued ones
+  for (unsigned int i = 0; i < ch->unsent_outputs; i++) {
+    output_release(&ch->batch[i]);
+  }
+  struct mitigate_output dropped;
+  while (ring_pop(&ch->queue, &dropped) == 0) {
+    output_release(&dropped);
+  }
+  slab_destroy(&ch->payloads);
+  slab_destroy(&ch->calls);
+  free(ch->call_early);
+  if (atomic_load(&ch->call_fd) >= 0)
+    close(atomic_load(&ch->call_fd));
+  pthread_cond_destroy(&ch->call_queued);
+  pthread_mutex_destroy(&ch->call_lock);
+  free(ch->iov);
+  free(ch->lines);
+  free(ch->batch);
+  policy_table_free(&ch->table);
+  ring_destroy(&ch->queue);
+  free(ch);
+}
+
+mitigate_channel_t *mitigate_channel_create(mitigator_t *m,
+                                            const struct mitigate_config *cfg) {
+  mitigate_channel_t *ch = aligned_alloc(RING_CACHE_LINE, sizeof(*ch));
+  if (ch == NULL)
+    return NULL;
+  memset(ch, 0, sizeof(*ch));
+  ch->m = m;
+  ch->cfg = cfg != NULL ? *cfg : m->cfg;
+  if (m->table.batch > 0)
+    ch->cfg.batch = m->table.batch;
+  enum ring_overflow overflow =
+      ch->cfg.queue_overflow == MITIGATE_QUEUE_REJECT ? RING_REJECT
+                                                      : RING_BLOCK;
+  if (ring_init(&ch->queue, ch->cfg.queue_capacity, overflow) != 0) {
+    free(ch);
+    return NULL;
+  }
+  pthread_mutex_init(&ch->call_lock, NULL);
+  pthread_cond_init(&ch->call_queued, NULL);
+  atomic_init(&ch->call_fd, -1);
+  ch->batch_limit = ch->cfg.batch > 0 ? ch->cfg.batch : 1;
+  // Each output may take a second iovec for its padding
+  if (ch->batch_limit > IOV_MAX / 2)
+    ch->batch_limit = IOV_MAX / 2;
+  ch->batch = malloc(ch->batch_limit * sizeof(*ch->batch));
+  ch->lines = malloc(ch->batch_limit * sizeof(*ch->lines));
+  ch->iov = malloc(2 * ch->batch_limit * sizeof(*ch->iov));
+  // Enough payload buffers for a full queue, a slot being written and one
+  // more in the producer's hands, so the producer never finds the slab empty
+  unsigned int npayloads = ring_capacity(&ch->queue) + ch->batch_limit + 1;
+  if (slab_init(&ch->payloads, ch->cfg.payload_size,
+                ch->cfg.payload_size > 0 ? npayloads : 0) != 0 ||
+      ch->batch == NULL || ch->lines == NULL || ch->iov == NULL) {
+    channel_free(ch);
+    return NULL;
+  }
+  atomic_init(&ch->submitted, 0);
+  atomic_init(&ch->parked, 0);
+  // A new channel's first epoch may already start on the learned quantum
+  ch->calibrated = ch->cfg.q_percentile > 0 && m->cfg.q_percentile > 0;
+  long long learned = atomic_load(&m->q_learned);
+  if (ch->calibrated && learned > 0)
+    ch->cfg.initial_q = learned;
+  // A channel on an initial_q of its own runs the schedule from there
+  const struct policy_table *table = NULL;
+  if (m->table.nlevels > 0) {
+    char err[256];
+    table = &m->table;
+    if (ch->cfg.initial_q != m->table.levels[0].q) {
+      if (policy_table_rebase(&ch->table, &m->table, ch->cfg.initial_q, err,
+                              sizeof(err)) != 0) {
+        channel_free(ch);
+        return NULL;
+      }
+      table = &ch->table;
+    }
+  }
+  policy_init(&ch->policy, &ch->cfg, table);
+  atomic_init(&ch->epoch_now, 0);
+  atomic_init(&ch->q_now, ch->policy.q);
+  release_timer_start(&ch->timer);
+  ch->last_release = ch->timer.start_ns;
+  ch->last_queued = ch->timer.start_ns;
+  ch->window_start = ch->timer.start_ns;
+  ch->entry.deadline = ch->timer.deadline_ns;
+
+  pthread_mutex_lock(&m->lock);
+  ch->id = m->next_id++;
+  if (sched_insert(&m->schedule, &ch->entry) != 0) {
+    pthread_mutex_unlock(&m->lock);
+    channel_free(ch);
+    return NULL;
+  }
+  ch->scheduled = 1;
+  // The new channel may now be the earliest deadline
+  mitigator_wake(m);
+  pthread_mutex_unlock(&m->lock);
+  return ch;
+}
+
+// Before a channel with calls is freed: drops its queued calls, which
+// complete like released ones, then sees every pending done callback
+// through, since the done list points into the channel's handle slab. The
+// thread driving the loop runs them itself, anyone else waits for it.
+// Called with the mitigator lock held.
+static void channel_calls_settle(mitigate_channel_t *ch) {
+  mitigator_t *m = ch->m;
+  struct mitigate_output dropped;
+  while (ring_pop(&ch->queue, &dropped) == 0) {
+    output_release(&dropped);
+  }
+  if (!m->has_thread || pthread_equal(pthread_self(), m->release_thread)) {
+    // Inside a done callback the list is already detached: nothing to do
+    while (!m->done_running && mitigator_run_done(m)) {
+    }
+    return;
+  }
+  mitigator_wake(m);
+  while (m->done != NULL || m->done_running) {
+    pthread_cond_wait(&m->drained, &m->lock);
+  }
+}
+
+// Waits for every call made on the channel to reach its queue, so no worker
+// still holds a handle. The release thread keeps serving the channel
+// meanwhile, or a call waiting for queue space would never get there.
+static void channel_calls_wait(mitigate_channel_t *ch) {
+  pthread_mutex_lock(&ch->call_lock);
+  ch->call_waiting = 1;
+  while (ch->call_next != ch->call_seq) {
+    pthread_cond_wait(&ch->call_queued, &ch->call_lock);
+  }
+  ch->call_waiting = 0;
+  pthread_mutex_unlock(&ch->call_lock);
+}
+
+void mitigate_channel_destroy(mitigate_channel_t *ch) {
+  mitigator_t *m = ch->m;
+  if (ch->call_early != NULL)
+    channel_calls_wait(ch);
+  pthread_mutex_lock(&m->lock);
+  if (ch->scheduled)
+    sched_remove(&m->schedule, &ch->entry);
+  mitigator_wake(m);
+  if (ch->call_early != NULL)
+    channel_calls_settle(ch);
+  pthread_mutex_unlock(&m->lock);
+  channel_free(ch);
+}
+
+unsigned int mitigate_channel_id(const mitigate_channel_t *ch) {
+  return ch->id;
+}
+
+void mitigate_channel_stats(mitigate_channel_t *ch,
+                            struct mitigate_channel_stats *stats) {
+  pthread_mutex_lock(&ch->m->lock);
+  stats->submitted = atomic_load(&ch->submitted);
+  stats->released = ch->released;
+  stats->release_slots = ch->release_slots;
+  stats->idle_ticks = ch->idle_ticks;
+  stats->epochs = ch->epochs;
+  stats->parks = ch->parks;
+  stats->write_errors = ch->write_errors;
+  stats->blocked_slots = ch->blocked_slots;
+  stats->q = ch->policy.q;
+  stats->throttled = ch->throttled;
+  double epoch_bits = channel_epoch_bits(ch);
+  // The window only moves along when the channel changes q
+  long long window = ch->cfg.leak_window_ns;
+  int window_over =
+      window > 0 && release_timer_now_ns() - ch->window_start >= window;
+  stats->window_bits =
+      window_over ? 0 : (ch->epochs - ch->window_epochs) * epoch_bits;
+  pthread_mutex_unlock(&ch->m->lock);
+  stats->leakage_bits = stats->epochs * epoch_bits;
+}
+
+// Queues an output already counted in submitted. Returns 0, or -1 if the
+// queue is full and rejects it; a blocking queue waits for a free slot.
+static int channel_enqueue(mitigate_channel_t *ch,
+                           const struct mitigate_output *out) {
+  int ret;
+  if (POLICY_OBSERVES) {
+    struct mitigate_output stamped = *out;
+    stamped.queued_ns = release_timer_now_ns();
+    ret = ring_push(&ch->queue, &stamped);
+  } else {
+    ret = ring_push(&ch->queue, out);
+  }
+  if (ret < 0)
+    return -1;
+  struct trace *trace = ch->m->trace;
+  if (trace != NULL)
+    trace_emit(trace, TRACE_SUBMIT, release_timer_now_ns(), ch->id,
+               atomic_load_explicit(&ch->epoch_now, memory_order_relaxed),
+               atomic_load_explicit(&ch->q_now, memory_order_relaxed),
+               ring_size(&ch->queue), 1);
+
+  // Only a channel coming out of parking costs a lock and a wakeup
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ch->parked, memory_order_relaxed) &&
+      atomic_exchange(&ch->parked, 0) == 1) {
+    pthread_mutex_lock(&ch->m->lock);
+    channel_unpark(ch);
+    pthread_mutex_unlock(&ch->m->lock);
+  }
+  return 0;
+}
+
+int mitigate_submit_output(mitigate_channel_t *ch,
+                           const struct mitigate_output *out) {
+  atomic_fetch_add_explicit(&ch->submitted, 1, memory_order_relaxed);
+  if (channel_enqueue(ch, out) != 0) {
+    // The queue was full, so a drainer still wakes once it empties
+    atomic_fetch_sub_explicit(&ch->submitted, 1, memory_order_relaxed);
+    return -1;
+  }
+  return 0;
+}
+
+void *mitigate_payload_alloc(mitigate_channel_t *ch) {
+  return slab_alloc(&ch->payloads);
+}
+
+// Release callback for buffers from mitigate_payload_alloc
+static void payload_release(const struct mitigate_output *out) {
+  mitigate_channel_t *ch = out->ctx;
+  slab_free(&ch->payloads, (void *)out->data);
+}
+
+int mitigate_submit_payload(mitigate_channel_t *ch, void *buf, size_t len) {
+  struct mitigate_output out = {
+      .data = buf, .len = len, .release = payload_release, .ctx = ch};
+  return mitigate_submit_output(ch, &out);
+}
+
+int mitigate_submit(mitigate_channel_t *ch, int output) {
+  struct mitigate_output out = {.value = output};
+  return mitigate_submit_output(ch, &out);
+}
+
+void mitigate_channel_drain(mitigate_channel_t *ch) {
+  mitigator_t *m = ch->m;
+  pthread_mutex_lock(&m->lock);
+  while (ch->released < atomic_load(&ch->submitted)) {
+    pthread_cond_wait(&m->drained, &m->lock);
+  }
+  pthread_mutex_unlock(&m->lock);
+}
+
+// Completes a released call: from here on it may be freed
+static void call_finish(mitigate_request_t *req) {
+  mitigate_channel_t *ch = req->ch;
+  int fd = atomic_load_explicit(&ch->call_fd, memory_order_acquire);
+  mitigate_done_fn done = req->done;
+  atomic_store_explicit(&req->complete, 1, memory_order_release);
+  if (fd >= 0) {
+    uint64_t one = 1;
+    (void)!write(fd, &one, sizeof(one));
+  }
+  if (done != NULL)
+    done(req, req->output, req->ctx);
+}
+
+// Release callback of a call's output, with the mitigator locked. Calls with
+// a done callback finish once the release loop has let go of the lock.
+static void call_complete(const struct mitigate_output *out) {
+  mitigate_request_t *req = out->ctx;
+  mitigator_t *m = req->ch->m;
+  if (req->done == NULL) {
+    call_finish(req);
+    return;
+  }
+  req->job.next = NULL;
+  if (m->done == NULL)
+    m->done = &req->job;
+  else
+    m->done_tail->next = &req->job;
+  m->done_tail = &req->job;
+}
+
+// Worker side of a call: evaluates it, then queues every finished call from
+// call_next on, so outputs reach the channel in call order
+static void call_run(struct pool_job *job) {
+  mitigate_request_t *req = container_of(job, mitigate_request_t, job);
+  mitigate_channel_t *ch = req->ch;
+  unsigned int n = ch->cfg.max_calls;
+  long long start = release_timer_now_ns();
+  if (req->fn_ctx != NULL)
+    req->output = req->fn_ctx(req->arg_ctx);
+  else
+    req->output = req->fn(req->arg);
+  mitigator_calibrate(ch->m, release_timer_now_ns() - start);
+
+  pthread_mutex_lock(&ch->call_lock);
+  ch->call_early[req->seq % n] = req;
+  while ((req = ch->call_early[ch->call_next % n]) != NULL &&
+         req->seq == ch->call_next) {
+    ch->call_early[ch->call_next % n] = NULL;
+    ch->call_next++;
+    struct mitigate_output out = {
+        .value = req->output, .release = call_complete, .ctx = req};
+    // Only more handles than a rejecting queue holds can fill it: wait as
+    // a blocking one would, rather than lose the call
+    while (channel_enqueue(ch, &out) != 0) {
+      sched_yield();
+    }
+  }
+  if (ch->call_waiting)
+    pthread_cond_broadcast(&ch->call_queued);
+  pthread_mutex_unlock(&ch->call_lock);
+}
+
+// First call on a channel: map its handles and the reorder window
+static int channel_calls_init(mitigate_channel_t *ch) {
+  unsigned int n = ch->cfg.max_calls;
+  if (n == 0)
+    return -1;
+  ch->call_early = calloc(n, sizeof(*ch->call_early));
+  if (ch->call_early == NULL ||
+      slab_init(&ch->calls, sizeof(mitigate_request_t), n) != 0) {
+    free(ch->call_early);
+    ch->call_early = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+// Takes a handle for a new call, NULL if none is free
+static mitigate_request_t *call_alloc(mitigate_channel_t *ch,
+                                      mitigate_done_fn done, void *ctx) {
+  if (ch->call_early == NULL && channel_calls_init(ch) != 0)
+    return NULL;
+  mitigate_request_t *req = slab_alloc(&ch->calls);
+  if (req == NULL)
+    return NULL;
+  memset(req, 0, sizeof(*req));
+  req->ch = ch;
+  req->done = done;
+  req->ctx = ctx;
+  req->seq = ch->call_seq++;
+  req->job.run = call_run;
+  return req;
+}
+
+static mitigate_request_t *call_post(mitigate_request_t *req) {
+  // Counted now so mitigate_channel_drain also waits for calls in flight
+  atomic_fetch_add_explicit(&req->ch->submitted, 1, memory_order_relaxed);
+  pool_submit(req->ch->m->workers, &req->job);
+  return req;
+}
+
+mitigate_request_t *mitigate_call(mitigate_channel_t *ch, int (*fn)(int),
+                                  int arg, mitigate_done_fn done,
+                                  void *ctx) {
+  mitigate_request_t *req = call_alloc(ch, done, ctx);
+  if (req == NULL)
+    return NULL;
+  req->fn = fn;
+  req->arg = arg;
+  return call_post(req);
+}
+
+mitigate_request_t *mitigate_call_ctx(mitigate_channel_t *ch,
+                                      int (*fn)(void *arg), void *arg,
+                                      mitigate_done_fn done, void *ctx) {
+  mitigate_request_t *req = call_alloc(ch, done, ctx);
+  if (req == NULL)
+    return NULL;
+  req->fn_ctx = fn;
+  req->arg_ctx = arg;
+  return call_post(req);
+}
+
+int mitigate_request_poll(mitigate_request_t *req, int *output) {
+  if (!atomic_load_explicit(&req->complete, memory_order_acquire))
+    return 0;
+  if (output != NULL)
+    *output = req->output;
+  return 1;
+}
+
+void mitigate_request_free(mitigate_request_t *req) {
+  slab_free(&req->ch->calls, req);
+}
+
+int mitigate_channel_eventfd(mitigate_channel_t *ch) {
+  int fd = atomic_load(&ch->call_fd);
+  if (fd >= 0)
+    return fd;
+  fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  int expected = -1;
+  if (!atomic_compare_exchange_strong(&ch->call_fd, &expected, fd)) {
+    close(fd);
+    return expected;
+  }
+  return fd;
+}
+
+mitigate_classes_t *mitigate_classes_create(mitigator_t *m,
+                                            const struct mitigate_config *cfg,
+                                            unsigned int nclasses,
+                                            const long long *initial_q) {
+  mitigate_classes_t *c =
+      calloc(1, sizeof(*c) + nclasses * sizeof(c->channels[0]));
+  if (c == NULL)
+    return NULL;
+  struct mitigate_config class_cfg = cfg != NULL ? *cfg : m->cfg;
+  if (initial_q != NULL)
+    class_cfg.q_percentile = 0; // the classes' own predictions stand
+  for (c->nclasses = 0; c->nclasses < nclasses; c->nclasses++) {
+    if (initial_q != NULL)
+      class_cfg.initial_q = initial_q[c->nclasses];
+    c->channels[c->nclasses] = mitigate_channel_create(m, &class_cfg);
+    if (c->channels[c->nclasses] == NULL) {
+      mitigate_classes_destroy(c);
+      return NULL;
+    }
+  }
+  return c;
+}
+
+void mitigate_classes_destroy(mitigate_classes_t *c) {
+  for (unsigned int i = 0; i < c->nclasses; i++) {
+    mitigate_channel_destroy(c->channels[i]);
+  }
+  free(c);
+}
+
+mitigate_channel_t *mitigate_class_channel(mitigate_classes_t *c,
+                                           unsigned int cls) {
+  return cls < c->nclasses ? c->channels[cls] : NULL;
+}
+
+void mitigate_classes_stats(mitigate_classes_t *c,
+                            struct mitigate_channel_stats *total) {
+  memset(total, 0, sizeof(*total));
+  for (unsigned int i = 0; i < c->nclasses; i++) {
+    struct mitigate_channel_stats s;
+    mitigate_channel_stats(c->channels[i], &s);
+    total->submitted += s.submitted;
+    total->released += s.released;
+    total->release_slots += s.release_slots;
+    total->idle_ticks += s.idle_ticks;
+    total->epochs += s.epochs;
+    total->parks += s.parks;
+    total->write_errors += s.write_errors;
+    total->blocked_slots += s.blocked_slots;
+    total->leakage_bits += s.leakage_bits;
+    total->window_bits += s.window_bits;
+    total->throttled += s.throttled;
+    if (s.q > total->q)
+      total->q = s.q;
+  }
+}
+
+// Called by the pool's reorder stage, in secrets order
+static void release_output(int output, long long ns, void *ctx) {
+  mitigate_channel_t *ch = ctx;
+  mitigator_calibrate(ch->m, ns);
+  mitigate_submit(ch, output);
+}
+
+int black_box_mitigator(mitigator_t *m, int (*target_function)(int),
+                        unsigned long long secrets[], int secrets_size) {
+  mitigate_channel_t *ch = mitigate_channel_create(m, NULL);
+  if (ch == NULL)
+    return -1;
+
+  int ret = m->sandbox != NULL
+                ? sandbox_map_ordered(m->sandbox, target_function, secrets,
+                                      secrets_size, release_output, ch)
+                : pool_map_ordered(m->workers, target_function, secrets,
+                                   secrets_size, release_output, ch);
+  mitigate_channel_drain(ch);
+  logger_flush(&m->log);
+  if (ret == 0 && m->cfg.log_releases)
+    printf("All outputs printed, exiting...\n");
+
+  mitigate_channel_destroy(ch);
+  return ret;
+}
@@ -0,0 +1,354 @@
+#ifndef MITIGATE_H
+#define MITIGATE_H
+
+// libmitigate: black-box timing mitigation. Outputs of a target function are
+// queued and released by a dedicated thread at most once per quantum q; the
+// policy that grows and shrinks q is fixed when the engine is compiled (see
+// policy.h), so each build of the library implements exactly one schedule.
+//
+// A mitigator owns one release thread that serves any number of channels.
+// Each channel is an independently mitigated output stream with its own
+// queue, quantum and epoch counter, e.g. one per user session or endpoint.
+
+#include <stddef.h>
+
+#include "mitigate_output.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mitigator mitigator_t;
+typedef struct mitigate_channel mitigate_channel_t;
+typedef struct evloop_watch mitigate_watch_t;
+typedef struct mitigate_request mitigate_request_t;
+typedef struct mitigate_classes mitigate_classes_t;
+
+// How the release thread finds the next channel due
+enum mitigate_scheduler {
+  MITIGATE_SCHED_HEAP,  // deadline min-heap, exact, O(log N) per release
+  MITIGATE_SCHED_WHEEL, // timer wheel, O(1), up to one tick late
+};
+
+// What drives the release schedule
+enum mitigate_loop {
+  MITIGATE_LOOP_THREAD,   // release thread sleeping on a condition variable
+  MITIGATE_LOOP_EPOLL,    // release thread running the timerfd/epoll loop
+  MITIGATE_LOOP_EMBEDDED, // no thread: the caller runs the epoll loop
+};
+
+// What the release thread does when the log writer can't keep up
+enum mitigate_log_overflow {
+  MITIGATE_LOG_DROP,  // skip the record and count it in log_dropped
+  MITIGATE_LOG_BLOCK, // wait for the writer, delaying the release loop
+};
+
+// What mitigate_submit* does when a channel's queue is full
+enum mitigate_queue_overflow {
+  MITIGATE_QUEUE_BLOCK,  // wait for the release thread to free a slot
+  MITIGATE_QUEUE_REJECT, // return -1 at once, leaving the output unqueued
+};
+
+struct mitigate_config {
+  long long initial_q;         // first quantum and reset value, in ns
+  long long max_q;             // ceiling for POLICY_CAPPED, in ns
+  // POLICY_CHANGEPOINT: CUSUM sum, in octaves of the gap between outputs,
+  // that confirms a phase change (see policy.h)
+  double change_threshold;
+  unsigned int queue_capacity; // pending outputs before the queue is full
+  enum mitigate_queue_overflow queue_overflow;
+  int nworkers;                // evaluation threads, <= 0 for one per CPU
+  int log_releases;            // log every release and quantum change
+  enum mitigate_scheduler scheduler;
+  long long wheel_tick_ns; // MITIGATE_SCHED_WHEEL granularity, in ns, > 0
+  enum mitigate_loop loop;
+  int park_idle; // unschedule idle channels the policy has settled (see below)
+  unsigned int batch; // most outputs one release slot may carry
+  // Where released outputs go, -1 for nowhere. The release thread never
+  // waits on it: a socket is written with MSG_DONTWAIT, anything else only
+  // when poll says it is writable, so a pipe should be O_NONBLOCK too. What
+  // it cannot take goes out on the channel's next slots.
+  int out_fd;
+  int log_fd;         // where log_releases lines go, -1 for nowhere
+  size_t payload_size; // bytes per mitigate_payload_alloc buffer, 0 for none
+  unsigned int log_capacity; // log records queued for the writer thread
+  enum mitigate_log_overflow log_overflow;
+  const char *trace_path; // binary event trace (see trace.h), NULL for none
+  unsigned int trace_segment_records; // records per trace segment
+  unsigned int trace_segments;        // segments before the trace wraps
+  // Ascending sizes every output is zero-padded up to, the smallest that
+  // fits, or a multiple of the largest beyond it; 0 buckets for no padding.
+  // Mitigator-wide, at most MITIGATE_PAD_BUCKETS, copied by mitigate_create.
+  const size_t *pad_buckets;
+  unsigned int pad_nbuckets;
+  unsigned int max_calls; // mitigate_call handles in flight per channel
+  // Worker processes black_box_mitigator runs target_function in (see
+  // sandbox.h), 0 to run it on the nworkers threads in-process
+  int sandbox_workers;
+  long long sandbox_timeout_ns; // a target running longer is killed, 0 never
+  // Calibration: learn initial_q as this percentile (0..1) of observed
+  // target_function durations instead of keeping it fixed; 0 to keep it
+  double q_percentile;
+  // Leakage budget: at most leak_budget_bits of each channel's leakage_bits
+  // per leak_window_ns (see below); 0 for no budget
+  double leak_budget_bits;
+  long long leak_window_ns;
+  // POLICY_TABLE: the schedule, as a file and as text whose lines override
+  // the file's (see policy_table.h); both NULL for POLICY_RESET's. Compiled
+  // by mitigate_create, and then the mitigator's initial_q and batch are the
+  // schedule's. A channel whose cfg brings another initial_q, as each of
+  // mitigate_classes_create's may, starts the same schedule from that
+  // quantum instead; the schedule's batch, if it sets one, holds for all.
+  // q_percentile must be 0.
+  const char *policy_path;
+  const char *policy_text;
+};
+
+// Calibration: every evaluation, by black_box_mitigator or mitigate_call,
+// feeds its duration into a P-squared percentile sketch (see quantile.h)
+// kept by the mitigator. The estimate is rounded up to a sixteenth of an
+// octave, and channels created with q_percentile set pick it up only when a
+// new epoch starts: as their first quantum, and as the quantum each reset
+// returns to (POLICY_RESET, POLICY_CAPPED). The choice among those rounded
+// values adds log2(MITIGATE_CALIBRATION_LEVELS) bits to each epoch's share
+// of leakage_bits, and nothing else changes within an epoch. The quanta
+// POLICY_CHANGEPOINT retunes to come from the same set and are counted the
+// same way.
+
+// Leakage budget: each channel charges every epoch it starts to the
+// current leak_window_ns window, at the per-epoch share of leakage_bits.
+// With more than half the budget left the policy runs unchecked; past that,
+// changes that would shrink q are refused, so the channel stays on larger
+// quanta that need fewer epochs; and a change that would overspend is
+// refused outright. A refused change leaves the policy as it was and starts
+// no epoch. A new window brings the full budget back.
+
+struct mitigate_channel_stats {
+  unsigned long long submitted;     // outputs handed to mitigate_submit
+  unsigned long long released;      // outputs that left on a release slot
+  unsigned long long release_slots; // slots that released at least one output
+  unsigned long long idle_ticks;    // slots that found the queue empty
+  unsigned long long epochs;        // quantum changes, at most one per slot
+  unsigned long long parks;         // times the channel was parked while idle
+  unsigned long long write_errors;  // slots whose outputs out_fd refused
+  unsigned long long blocked_slots; // slots out_fd was still too full for
+  long long q;                      // current quantum, in ns
+  // Bound on the bits the release timing can have revealed so far: each
+  // epoch ends at one of at most released + 1 points, so
+  // epochs * log2(released + 1), plus the calibration term (see below)
+  double leakage_bits;
+  double window_bits;          // of leakage_bits, spent in the budget window
+  unsigned long long throttled; // quantum changes the budget refused
+};
+
+#define MITIGATE_LATENESS_BUCKETS 4096 // 1 us each, the last one open-ended
+#define MITIGATE_PAD_BUCKETS 16
+#define MITIGATE_CALIBRATION_LEVELS 481 // 2^10 to 2^40 ns, 16 per octave
+
+// Output released for a secret whose sandboxed target crashed or hung
+#define MITIGATE_TARGET_FAILED (-2147483647 - 1)
+
+// Outputs padded into one bucket. padded_bytes / payload_bytes is the
+// bandwidth the bucket costs.
+struct mitigate_pad_stats {
+  size_t size; // the bucket, 0 past the last one configured
+  unsigned long long outputs;
+  unsigned long long payload_bytes;
+  unsigned long long padded_bytes;
+};
+
+struct mitigate_stats {
+  unsigned long long ticks; // release slots served, over all channels
+  unsigned long long log_dropped; // log records lost to MITIGATE_LOG_DROP
+  struct mitigate_pad_stats pad[MITIGATE_PAD_BUCKETS];
+  long long release_cpu_ns; // CPU time used by the release thread so far
+  unsigned long long sandbox_restarts; // workers replaced after crash or hang
+  long long learned_q; // calibrated quantum, 0 until there is a sample
+  // Slots by how late they were served, in microseconds
+  unsigned long long lateness[MITIGATE_LATENESS_BUCKETS];
+};
+
+// Fills in the defaults: 0.1 s initial quantum, 16 s cap, one worker per CPU,
+// heap scheduler (10 us ticks if switched to the wheel), condvar thread, one
+// output per slot, outputs and logs written to stdout, log records dropped
+// rather than waited for once 4096 are queued, no trace (4 x 64Ki records
+// when one is set), no padding, 1024 calls in flight per channel, targets
+// run in-process (1 s sandbox timeout when sandbox_workers is set), no
+// calibration, no leakage budget (1 s windows when one is set), no policy
+// file
+void mitigate_config_init(struct mitigate_config *cfg);
+
+// Starts the worker pool, the log writer and, unless cfg->loop is
+// MITIGATE_LOOP_EMBEDDED, the release thread. Returns NULL on failure.
+mitigator_t *mitigate_create(const struct mitigate_config *cfg);
+
+// Compiles cfg's policy_path and policy_text as mitigate_create would.
+// Returns 0, or -1 with what is wrong in err; always 0 unless the policy is
+// POLICY_TABLE.
+int mitigate_policy_check(const struct mitigate_config *cfg, char *err,
+                          size_t errlen);
+
+// Stops the release thread and writes out the remaining log. Every channel
+// must have been destroyed.
+void mitigate_destroy(mitigator_t *m);
+
+// Name of the policy this copy of the engine was compiled with
+const char *mitigate_policy_name(void);
+
+void mitigate_stats(mitigator_t *m, struct mitigate_stats *stats);
+
+// Lateness in ns that fraction p (0..1) of the slots in stats were served
+// within, rounded up to the microsecond
+long long mitigate_lateness_percentile(const struct mitigate_stats *stats,
+                                       double p);
+
+// Event loop modes only. The epoll fd of the release loop: it polls readable
+// whenever a release deadline, wakeup or watched fd is due, so it can be
+// added to a server's own epoll set. With MITIGATE_LOOP_EMBEDDED the server
+// then calls mitigate_loop_dispatch whenever it is readable.
+int mitigate_loop_fd(mitigator_t *m);
+
+// Runs one round of the release loop: waits up to timeout_ms (-1 for ever),
+// serves due channels and runs callbacks of ready watched fds. Returns the
+// number of events handled, or -1 with errno set. Only for
+// MITIGATE_LOOP_EMBEDDED, where it must always be called from one thread.
+int mitigate_loop_dispatch(mitigator_t *m, int timeout_ms);
+
+// Event loop modes only. Calls fn(fd, events, ctx) on the release loop's
+// thread whenever fd has any of the epoll events ready, e.g. a listening or
+// client socket. fn may submit and create or destroy channels. Returns NULL
+// on failure.
+mitigate_watch_t *mitigate_loop_watch(mitigator_t *m, int fd,
+                                      unsigned int events,
+                                      void (*fn)(int fd, unsigned int events,
+                                                 void *ctx),
+                                      void *ctx);
+
+// Stops watching; from the loop's thread, or while the loop isn't running
+void mitigate_loop_unwatch(mitigator_t *m, mitigate_watch_t *w);
+
+// Idle parking: once a channel is idle and its policy says further idle
+// ticks would change nothing (policy_idle_settled), the release loop stops
+// waking up for it. The next mitigate_submit puts it back on the slot it
+// would have reached anyway, counting the skipped slots as idle ticks, so
+// the release schedule is exactly the one an always-ticking channel has.
+
+// Adds a channel whose first release slot is now. cfg may be NULL to use the
+// mitigator's; only the quantum, queue, batch, fd, payload, call, budget and
+// logging fields are read. Returns NULL on failure.
+mitigate_channel_t *mitigate_channel_create(mitigator_t *m,
+                                            const struct mitigate_config *cfg);
+
+// Unschedules the channel and drops anything still queued on it, calling
+// each dropped output's release. Calls still on the worker pool are waited
+// for first, then dropped with the rest: dropped calls complete as if
+// released, and every done callback of the channel has run by the time it
+// returns.
+void mitigate_channel_destroy(mitigate_channel_t *ch);
+
+unsigned int mitigate_channel_id(const mitigate_channel_t *ch);
+
+void mitigate_channel_stats(mitigate_channel_t *ch,
+                            struct mitigate_channel_stats *stats);
+
+// Queues an output for release on ch. Only one thread may submit to a given
+// channel at a time. If the queue is full, waits for space, or with
+// MITIGATE_QUEUE_REJECT returns -1 without calling out->release. Returns 0
+// once queued.
+// Only the descriptor is copied: out->data must stay valid, and unchanged,
+// until out->release is called.
+int mitigate_submit_output(mitigate_channel_t *ch,
+                           const struct mitigate_output *out);
+
+// Same for an int output, released as the line "Channel <id> output: <int>"
+int mitigate_submit(mitigate_channel_t *ch, int output);
+
+// Returns a cfg.payload_size byte buffer from the channel's preallocated,
+// prefaulted slab, in constant time, or NULL if every buffer is taken. Only
+// the submitting thread may call it. The channel holds enough buffers that
+// one is always free as long as each is submitted before the next is taken.
+void *mitigate_payload_alloc(mitigate_channel_t *ch);
+
+// Queues len bytes of a buffer from mitigate_payload_alloc. The buffer goes
+// back to the slab by itself once it has been written; if the output is
+// rejected, it stays the caller's.
+int mitigate_submit_payload(mitigate_channel_t *ch, void *buf, size_t len);
+
+// Asynchronous calls: mitigate_call evaluates fn(arg) on the worker pool and
+// returns at once with a handle. The output joins the channel's queue in call
+// order, as though it had been submitted, and leaves on a release slot like
+// any other. At that moment the handle completes: done (if not NULL) runs,
+// the channel's eventfd (if asked for) is signalled and
+// mitigate_request_poll starts returning 1.
+//
+// Calls and mitigate_submit* must not be mixed on one channel, and only one
+// thread may call on a given channel at a time. done runs on the release
+// thread once it has served the slot and let go of the mitigator lock; it
+// should not block, since later releases wait for it. Without done, a call
+// completes on its slot itself.
+typedef void (*mitigate_done_fn)(mitigate_request_t *req, int output,
+                                 void *ctx);
+
+// Returns NULL if all cfg.max_calls handles of the channel are in use
+mitigate_request_t *mitigate_call(mitigate_channel_t *ch, int (*fn)(int),
+                                  int arg, mitigate_done_fn done, void *ctx);
+
+// Same, evaluating fn(arg) for an arbitrary argument
+mitigate_request_t *mitigate_call_ctx(mitigate_channel_t *ch,
+                                      int (*fn)(void *arg), void *arg,
+                                      mitigate_done_fn done, void *ctx);
+
+// Returns 1 and stores the output once req has completed, 0 until then
+int mitigate_request_poll(mitigate_request_t *req, int *output);
+
+// Gives the handle back once it has completed (from done at the earliest).
+// Any thread.
+void mitigate_request_free(mitigate_request_t *req);
+
+// Non-blocking eventfd that counts completions on ch, e.g. to add to a
+// server's epoll set. Owned by the channel. Returns -1 on failure.
+int mitigate_channel_eventfd(mitigate_channel_t *ch);
+
+// Blocks until everything submitted to ch so far has been released. With
+// MITIGATE_LOOP_EMBEDDED, never call it from the thread driving the loop.
+void mitigate_channel_drain(mitigate_channel_t *ch);
+
+// Predictive mitigation by public class: requests carry a label known to
+// the attacker anyway (endpoint, size bucket of the public input, ...), and
+// each class is a channel of its own, with its own prediction (quantum),
+// epochs and doubling penalty. Cheap classes stop paying the quanta the
+// expensive ones need, and since the label is public, the class bounds add
+// up to the total. Classes share cfg's out_fd; outputs of different classes
+// may leave in any order relative to each other.
+
+// Creates nclasses channels from cfg (NULL for the mitigator's), class i
+// starting with quantum initial_q[i] (initial_q NULL for cfg's everywhere).
+// Returns NULL on failure.
+mitigate_classes_t *mitigate_classes_create(mitigator_t *m,
+                                            const struct mitigate_config *cfg,
+                                            unsigned int nclasses,
+                                            const long long *initial_q);
+
+void mitigate_classes_destroy(mitigate_classes_t *c);
+
+// The channel of class cls, to submit or call on like any other
+mitigate_channel_t *mitigate_class_channel(mitigate_classes_t *c,
+                                           unsigned int cls);
+
+// Sums the stats of every class; leakage_bits is the total bound and q the
+// largest quantum. Each class has its own leakage budget.
+void mitigate_classes_stats(mitigate_classes_t *c,
+                            struct mitigate_channel_stats *total);
+
+// Black box mitigator function: evaluates target_function on every secret and
+// releases the outputs in order on a fresh channel. Blocks until the last
+// output has been released, so it needs a release thread (not
+// MITIGATE_LOOP_EMBEDDED). Returns 0, or -1 if the run couldn't start.
+int black_box_mitigator(mitigator_t *m, int (*target_function)(int),
+                        unsigned long long secrets[], int secrets_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
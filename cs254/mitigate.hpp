@@ -0,0 +1,104 @@
+#ifndef MITIGATE_HPP
+#define MITIGATE_HPP
+
+// C++20 coroutine front end for libmitigate, header only.
+//
+//   int output = co_await mitigate::mitigated(channel, fn, args...);
+//
+// evaluates fn(args...) on the mitigator's worker pool through
+// mitigate_call_ctx and suspends the coroutine until the output's release
+// slot. It then resumes on the release thread, or through the executor
+// given to mitigated_on. The awaiter lives in the coroutine frame and the
+// call handle comes from the channel's preallocated handles, so an await
+// allocates nothing. fn's result is the channel output, so it must convert
+// to int.
+//
+// The rules of mitigate_call apply: one coroutine at a time per channel,
+// which is what a session awaiting its own channel naturally does.
+
+#include <coroutine>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include "mitigate.h"
+
+namespace mitigate {
+
+// Resumes right away on the release thread, after it has let go of the
+// mitigator lock. Keep what runs there short: later releases wait for it.
+struct release_executor {
+  void post(std::coroutine_handle<> h) const { h.resume(); }
+};
+
+// Awaiter returned by mitigated and mitigated_on. Executor is anything with
+// post(std::coroutine_handle<>), held by value.
+template <class Executor, class Fn, class... Args> class awaiter {
+public:
+  awaiter(mitigate_channel_t *ch, Executor ex, Fn fn, Args... args)
+      : ch_(ch), ex_(std::move(ex)), fn_(std::move(fn)),
+        args_(std::move(args)...) {}
+
+  awaiter(const awaiter &) = delete;
+  awaiter &operator=(const awaiter &) = delete;
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    handle_ = h;
+    // Once the call is queued, done may resume the coroutine and end the
+    // awaiter's life before mitigate_call_ctx even returns: from here on,
+    // touch nothing of this
+    mitigate_request_t *req = mitigate_call_ctx(
+        ch_, &awaiter::evaluate, this, &awaiter::done, this);
+    if (req == nullptr)
+      throw std::runtime_error("mitigate_call: no free call handle");
+  }
+
+  int await_resume() {
+    mitigate_request_free(req_);
+    return output_;
+  }
+
+private:
+  // On a pool worker
+  static int evaluate(void *self) {
+    auto *a = static_cast<awaiter *>(self);
+    return static_cast<int>(std::apply(a->fn_, a->args_));
+  }
+
+  // On the release thread, once the output's slot has come
+  static void done(mitigate_request_t *req, int output, void *self) {
+    auto *a = static_cast<awaiter *>(self);
+    a->req_ = req;
+    a->output_ = output;
+    a->ex_.post(a->handle_);
+  }
+
+  mitigate_channel_t *ch_;
+  Executor ex_;
+  Fn fn_;
+  std::tuple<Args...> args_;
+  std::coroutine_handle<> handle_;
+  mitigate_request_t *req_ = nullptr;
+  int output_ = 0;
+};
+
+template <class Fn, class... Args>
+awaiter<release_executor, std::decay_t<Fn>, std::decay_t<Args>...>
+mitigated(mitigate_channel_t *ch, Fn &&fn, Args &&...args) {
+  return {ch, release_executor{}, std::forward<Fn>(fn),
+          std::forward<Args>(args)...};
+}
+
+template <class Executor, class Fn, class... Args>
+awaiter<std::decay_t<Executor>, std::decay_t<Fn>, std::decay_t<Args>...>
+mitigated_on(Executor &&ex, mitigate_channel_t *ch, Fn &&fn,
+             Args &&...args) {
+  return {ch, std::forward<Executor>(ex), std::forward<Fn>(fn),
+          std::forward<Args>(args)...};
+}
+
+} // namespace mitigate
+
+#endif
@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mitigate_client.h"
+#include "mitigated_proto.h"
+
+struct mitigate_client {
+  int sock;
+  int submit_bell;
+  int release_bell;
+  struct mitigated_shm *shm;
+  size_t shm_bytes;
+  unsigned int capacity;        // of each ring, as read at connect
+  unsigned long long submitted; // outputs handed to the daemon
+  unsigned long long taken;     // releases returned by mitigate_client_poll
+};
+
+// Receives the hello and its three fds
+// Close every descriptor a rejected handshake message carried
+static void close_received(struct msghdr *msg) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < n; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+      close(fd);
+    }
+  }
+}
+
+static int client_handshake(mitigate_client_t *c, int fds[3]) {
+  struct mitigated_hello hello;
+  struct iovec iov = {.iov_base = &hello, .iov_len = sizeof(hello)};
+  union {
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+  ssize_t n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+  if (n < 0)
+    return -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (n != sizeof(hello) || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+    close_received(&msg);
+    errno = EPROTO;
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+  if (hello.magic != MITIGATED_MAGIC || hello.version != MITIGATED_VERSION) {
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    errno = EPROTO;
+    return -1;
+  }
+  c->shm_bytes = hello.shm_bytes;
+  return 0;
+}
+
+mitigate_client_t *mitigate_client_connect(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  strncpy(addr.sun_path, path != NULL ? path : MITIGATED_SOCKET,
+          sizeof(addr.sun_path) - 1);
+
+  mitigate_client_t *c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return NULL;
+  c->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int fds[3];
+  if (c->sock < 0 ||
+      connect(c->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      client_handshake(c, fds) != 0) {
+    if (c->sock >= 0)
+      close(c->sock);
+    free(c);
+    return NULL;
+  }
+  c->shm = mmap(NULL, c->shm_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0],
+                0);
+  close(fds[0]);
+  c->submit_bell = fds[1];
+  c->release_bell = fds[2];
+  if (c->shm == MAP_FAILED) {
+    mitigate_client_close(c);
+    return NULL;
+  }
+  c->capacity = c->shm->capacity;
+  if (c->capacity == 0 || (c->capacity & (c->capacity - 1)) != 0 ||
+      mitigated_shm_bytes(c->capacity) > c->shm_bytes) {
+    mitigate_client_close(c);
+    errno = EPROTO;
+    return NULL;
+  }
+  return c;
+}
+
+void mitigate_client_close(mitigate_client_t *c) {
+  if (c->shm != MAP_FAILED && c->shm != NULL)
+    munmap(c->shm, c->shm_bytes);
+  close(c->release_bell);
+  close(c->submit_bell);
+  close(c->sock);
+  free(c);
+}
+
+unsigned int mitigate_client_capacity(const mitigate_client_t *c) {
+  return c->capacity;
+}
+
+int mitigate_client_submit(mitigate_client_t *c, uint64_t channel,
+                           uint64_t tag) {
+  // Never more in flight than the release ring holds, so the daemon always
+  // has room to report a release
+  if (c->submitted - c->taken >= c->capacity)
+    return -1;
+  struct mitigated_msg msg = {.channel = channel, .tag = tag};
+  if (shm_ring_push(c->shm, &c->shm->submit, c->capacity, &msg) != 0)
+    return -1;
+  c->submitted++;
+  if (shm_ring_should_ring(&c->shm->submit)) {
+    uint64_t one = 1;
+    (void)!write(c->submit_bell, &one, sizeof(one));
+  }
+  return 0;
+}
+
+int mitigate_client_poll(mitigate_client_t *c, uint64_t *channel,
+                         uint64_t *tag, enum mitigate_client_status *status,
+                         int64_t *time_ns) {
+  struct mitigated_msg msg;
+  if (shm_ring_pop(c->shm, &c->shm->release, c->capacity, &msg) != 0)
+    return 0;
+  c->taken++;
+  if (channel != NULL)
+    *channel = msg.channel;
+  if (tag != NULL)
+    *tag = msg.tag;
+  if (status != NULL)
+    *status = msg.status == MITIGATED_REJECTED ? MITIGATE_CLIENT_REJECTED
+                                               : MITIGATE_CLIENT_RELEASED;
+  if (time_ns != NULL)
+    *time_ns = msg.time_ns;
+  return 1;
+}
+
+int mitigate_client_fd(const mitigate_client_t *c) { return c->release_bell; }
+
+int mitigate_client_arm(mitigate_client_t *c) {
+  return shm_ring_arm(&c->shm->release);
+}
+
+int mitigate_client_wait(mitigate_client_t *c, int timeout_ms) {
+  while (mitigate_client_arm(c)) {
+    struct pollfd fds[2] = {{.fd = c->release_bell, .events = POLLIN},
+                            {.fd = c->sock, .events = POLLIN}};
+    int n = poll(fds, 2, timeout_ms);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 || fds[1].revents != 0)
+      return -1; // the daemon only ever closes the socket
+    if (n == 0)
+      return 0;
+    uint64_t count;
+    (void)!read(c->release_bell, &count, sizeof(count));
+  }
+  return 1;
+}
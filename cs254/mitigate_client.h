@@ -0,0 +1,54 @@
+#ifndef MITIGATE_CLIENT_H
+#define MITIGATE_CLIENT_H
+
+#include <stdint.h>
+
+// libmitigate-client: submits outputs to a mitigated daemon running on the
+// same machine and learns when each one may go out. The daemon owns the
+// channel schedules, so every process submitting on a channel key shares
+// one quantum and one epoch history. The client keeps its outputs and sends
+// each one itself once the daemon reports its release.
+//
+// A client is used by one thread at a time.
+
+typedef struct mitigate_client mitigate_client_t;
+
+// What the daemon did with a submitted output
+enum mitigate_client_status {
+  MITIGATE_CLIENT_RELEASED, // its slot has come: send it now
+  MITIGATE_CLIENT_REJECTED, // queue full or daemon stopping: never send it
+};
+
+// Connects to the daemon at path (NULL for MITIGATED_SOCKET). Returns NULL
+// with errno set on failure.
+mitigate_client_t *mitigate_client_connect(const char *path);
+void mitigate_client_close(mitigate_client_t *c);
+
+// Outputs submitted but not yet taken with mitigate_client_poll, at most
+unsigned int mitigate_client_capacity(const mitigate_client_t *c);
+
+// Queues the output `tag` for release on channel. No syscall unless the
+// daemon is asleep. Returns 0, or -1 if capacity outputs are already in
+// flight.
+int mitigate_client_submit(mitigate_client_t *c, uint64_t channel,
+                           uint64_t tag);
+
+// Takes the next output the daemon is done with: returns 1 and fills in its
+// channel, tag, status and when the daemon reported it (CLOCK_MONOTONIC ns;
+// any pointer may be NULL), or 0 if none is ready. Either way the output no
+// longer counts against the capacity.
+int mitigate_client_poll(mitigate_client_t *c, uint64_t *channel,
+                         uint64_t *tag, enum mitigate_client_status *status,
+                         int64_t *time_ns);
+
+// Waits up to timeout_ms (-1 for ever) for a release to be ready. Returns 1
+// if one is, 0 on timeout and -1 if the daemon has gone away.
+int mitigate_client_wait(mitigate_client_t *c, int timeout_ms);
+
+// For a caller's own epoll loop: the fd readable when releases arrive. Call
+// mitigate_client_arm before sleeping on it; if that returns 0, releases are
+// already waiting and it will not be signalled for them.
+int mitigate_client_fd(const mitigate_client_t *c);
+int mitigate_client_arm(mitigate_client_t *c);
+
+#endif
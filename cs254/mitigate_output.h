@@ -0,0 +1,19 @@
+#ifndef MITIGATE_OUTPUT_H
+#define MITIGATE_OUTPUT_H
+
+#include <stddef.h>
+
+// An output to release: len bytes at data, written to the channel's out_fd
+// straight from the producer's buffer. Once they have been written (or the
+// output is dropped with its channel) the release thread calls
+// release(out), so the producer can reuse the buffer; release may be NULL.
+struct mitigate_output {
+  const void *data;
+  size_t len;
+  void (*release)(const struct mitigate_output *out);
+  void *ctx;  // for release
+  int value;  // the int passed to mitigate_submit, which leaves data NULL
+  long long queued_ns; // set by the engine, for policies that observe gaps
+};
+
+#endif
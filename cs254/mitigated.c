@@ -0,0 +1,450 @@
+#define _GNU_SOURCE // memfd_create, accept4
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mitigate.h"
+#include "mitigated_proto.h"
+#include "slab.h"
+
+// mitigated: the mitigation engine as a standalone daemon. Clients
+// (libmitigate-client) submit outputs on channel keys through shared-memory
+// rings; the daemon queues each one on the key's channel and, when its
+// release slot comes, reports it back on the client's release ring. An
+// output whose channel queue is full is reported back at once, rejected. All
+// schedules live here, so processes submitting on the same key share its
+// quantum and epochs. Channels are created on first use and live as long as
+// the daemon.
+//
+// Usage: mitigated [-s socket] [-q initial_q_ms] [-m max_q_ms]
+//                  [-r ring_slots] [-c queue_capacity] [-w]
+//                  [-p policy_file] [-P 'key = value; ...']
+// where -p and -P give the schedule (see policy_table.h), so one binary can
+// run different schedules side by side.
+
+struct client {
+  int sock;
+  int submit_bell;
+  int release_bell;
+  struct mitigated_shm *shm;
+  size_t shm_bytes;
+  unsigned int capacity; // of each ring; the client can rewrite shm's copy
+  // The release ring has two producers: the release thread reporting
+  // releases and the main thread reporting rejections
+  pthread_mutex_t release_lock;
+  struct slab pending; // one per output in flight, freed on release
+  atomic_int refs;     // the connection plus every pending output
+  atomic_int closed;
+  unsigned long long rejected; // requests reported back as rejected
+};
+
+// An output queued on a channel on a client's behalf
+struct pending {
+  struct client *client;
+  uint64_t channel;
+  uint64_t tag;
+};
+
+// Open-addressing map from channel key to channel, main thread only
+struct channel_map {
+  uint64_t *keys;
+  mitigate_channel_t **channels;
+  size_t size; // a power of two
+  size_t count;
+};
+
+static volatile sig_atomic_t stopping;
+// Set once the daemon is shutting down: outputs still queued are dropped
+// with their channels, and must not leave outside their slots
+static atomic_int dropping;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static size_t map_slot(const struct channel_map *map, uint64_t key) {
+  // Fibonacci hashing, then linear probing
+  size_t i = (key * 0x9e3779b97f4a7c15ULL) & (map->size - 1);
+  while (map->channels[i] != NULL && map->keys[i] != key) {
+    i = (i + 1) & (map->size - 1);
+  }
+  return i;
+}
+
+static int map_grow(struct channel_map *map) {
+  struct channel_map bigger = {.size = map->size ? 2 * map->size : 64};
+  bigger.keys = calloc(bigger.size, sizeof(*bigger.keys));
+  bigger.channels = calloc(bigger.size, sizeof(*bigger.channels));
+  if (bigger.keys == NULL || bigger.channels == NULL) {
+    free(bigger.keys);
+    free(bigger.channels);
+    return -1;
+  }
+  for (size_t i = 0; i < map->size; i++) {
+    if (map->channels[i] != NULL) {
+      size_t j = map_slot(&bigger, map->keys[i]);
+      bigger.keys[j] = map->keys[i];
+      bigger.channels[j] = map->channels[i];
+    }
+  }
+  bigger.count = map->count;
+  free(map->keys);
+  free(map->channels);
+  *map = bigger;
+  return 0;
+}
+
+// The channel for key, created on first use. NULL on failure.
+static mitigate_channel_t *map_get(struct channel_map *map, mitigator_t *m,
+                                   uint64_t key) {
+  if (2 * (map->count + 1) > map->size && map_grow(map) != 0)
+    return NULL;
+  size_t i = map_slot(map, key);
+  if (map->channels[i] == NULL) {
+    map->channels[i] = mitigate_channel_create(m, NULL);
+    if (map->channels[i] == NULL)
+      return NULL;
+    map->keys[i] = key;
+    map->count++;
+  }
+  return map->channels[i];
+}
+
+static void client_unref(struct client *c) {
+  if (atomic_fetch_sub(&c->refs, 1) != 1)
+    return;
+  slab_destroy(&c->pending);
+  pthread_mutex_destroy(&c->release_lock);
+  munmap(c->shm, c->shm_bytes);
+  close(c->release_bell);
+  close(c->submit_bell);
+  free(c);
+}
+
+// Reports a release or rejection to the client, stamped now. Its release
+// ring cannot be full: clients keep no more in flight than it holds, and a
+// client that breaks that rule only loses its own messages.
+static void client_report(struct client *c, uint64_t channel, uint64_t tag,
+                          uint32_t status) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  struct mitigated_msg msg = {
+      .channel = channel,
+      .tag = tag,
+      .time_ns = now.tv_sec * 1000000000LL + now.tv_nsec,
+      .status = status,
+  };
+  pthread_mutex_lock(&c->release_lock);
+  shm_ring_push(c->shm, &c->shm->release, c->capacity, &msg);
+  int ring = shm_ring_should_ring(&c->shm->release);
+  pthread_mutex_unlock(&c->release_lock);
+  if (ring) {
+    uint64_t one = 1;
+    (void)!write(c->release_bell, &one, sizeof(one));
+  }
+}
+
+// Release callback, on the release thread or while shutting down: report the
+// release, or the drop, to the client unless it has gone
+static void pending_release(const struct mitigate_output *out) {
+  struct pending *p = out->ctx;
+  struct client *c = p->client;
+  if (!atomic_load(&c->closed))
+    client_report(c, p->channel, p->tag,
+                  atomic_load(&dropping) ? MITIGATED_REJECTED
+                                         : MITIGATED_RELEASED);
+  slab_free(&c->pending, p);
+  client_unref(c);
+}
+
+// Sends the hello with the shared memory and both doorbells
+static int client_hello(struct client *c, int memfd) {
+  struct mitigated_hello hello = {.magic = MITIGATED_MAGIC,
+                                  .version = MITIGATED_VERSION,
+                                  .shm_bytes = c->shm_bytes};
+  int fds[3] = {memfd, c->submit_bell, c->release_bell};
+  struct iovec iov = {.iov_base = &hello, .iov_len = sizeof(hello)};
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  return sendmsg(c->sock, &msg, MSG_NOSIGNAL) == sizeof(hello) ? 0 : -1;
+}
+
+static struct client *client_new(int sock, unsigned int capacity) {
+  struct client *c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return NULL;
+  c->sock = sock;
+  c->capacity = capacity;
+  c->shm_bytes = mitigated_shm_bytes(capacity);
+  c->submit_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  c->release_bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int memfd = memfd_create("mitigated", MFD_CLOEXEC);
+  c->shm = MAP_FAILED;
+  if (memfd >= 0 && ftruncate(memfd, c->shm_bytes) == 0)
+    c->shm = mmap(NULL, c->shm_bytes, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, memfd, 0);
+  if (c->submit_bell < 0 || c->release_bell < 0 || c->shm == MAP_FAILED ||
+      slab_init(&c->pending, sizeof(struct pending), capacity) != 0) {
+    if (c->shm != MAP_FAILED)
+      munmap(c->shm, c->shm_bytes);
+    if (memfd >= 0)
+      close(memfd);
+    if (c->submit_bell >= 0)
+      close(c->submit_bell);
+    if (c->release_bell >= 0)
+      close(c->release_bell);
+    free(c);
+    return NULL;
+  }
+
+  c->shm->magic = MITIGATED_MAGIC;
+  c->shm->version = MITIGATED_VERSION;
+  c->shm->capacity = capacity;
+  pthread_mutex_init(&c->release_lock, NULL);
+  atomic_init(&c->refs, 1);
+  atomic_init(&c->closed, 0);
+  int ret = client_hello(c, memfd);
+  close(memfd);
+  if (ret != 0) {
+    client_unref(c);
+    return NULL;
+  }
+  return c;
+}
+
+// Stops serving the client. Returns 1 if it was still open, and then the
+// caller drops the connection's reference once nothing can name the client;
+// outputs still queued keep it alive until released.
+static int client_close(struct client *c, int epfd) {
+  if (atomic_exchange(&c->closed, 1))
+    return 0;
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->sock, NULL);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->submit_bell, NULL);
+  close(c->sock);
+  return 1;
+}
+
+// Queues one request on its channel. Channels reject rather than wait when
+// their queue is full, since waiting here would stall every client; the
+// rejection goes back to the client so the output's slot in its capacity
+// comes back too.
+static void client_request(struct client *c, struct channel_map *map,
+                           mitigator_t *m, const struct mitigated_msg *msg) {
+  mitigate_channel_t *ch = map_get(map, m, msg->channel);
+  struct pending *p = ch != NULL ? slab_alloc(&c->pending) : NULL;
+  if (p != NULL) {
+    p->client = c;
+    p->channel = msg->channel;
+    p->tag = msg->tag;
+    atomic_fetch_add(&c->refs, 1);
+    struct mitigate_output out = {.release = pending_release, .ctx = p};
+    if (mitigate_submit_output(ch, &out) == 0)
+      return;
+    atomic_fetch_sub(&c->refs, 1); // the connection still holds one
+    slab_free(&c->pending, p);
+  }
+  c->rejected++;
+  client_report(c, msg->channel, msg->tag, MITIGATED_REJECTED);
+}
+
+// Moves everything in the client's submit ring onto its channels, then tells
+// the client to ring once more before the daemon sleeps. Returns -1 if the
+// client has broken the ring, and must be disconnected.
+static int client_drain(struct client *c, struct channel_map *map,
+                        mitigator_t *m) {
+  uint64_t count;
+  (void)!read(c->submit_bell, &count, sizeof(count));
+  do {
+    struct mitigated_msg msg;
+    int ret;
+    while ((ret = shm_ring_pop(c->shm, &c->shm->submit, c->capacity,
+                               &msg)) == 0) {
+      client_request(c, map, m, &msg);
+    }
+    if (ret == -2)
+      return -1;
+  } while (!shm_ring_arm(&c->shm->submit));
+  return 0;
+}
+
+static int listen_on(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+    return -1;
+  unlink(path);
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(sock, 64) != 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+// 0 if n is above 2^31, where the next power of two would not fit
+static unsigned int round_up_pow2(unsigned long n) {
+  if (n > 1ul << 31)
+    return 0;
+  unsigned int size = 1;
+  while (size < n) {
+    size <<= 1;
+  }
+  return size;
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = MITIGATED_SOCKET;
+  unsigned int ring_slots = 1024;
+  struct mitigate_config cfg;
+  mitigate_config_init(&cfg);
+  cfg.out_fd = -1; // clients send their outputs themselves
+  cfg.log_releases = 0;
+  cfg.queue_overflow = MITIGATE_QUEUE_REJECT; // never stall the main loop
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:q:m:r:c:wp:P:")) != -1) {
+    switch (opt) {
+    case 's':
+      path = optarg;
+      break;
+    case 'q':
+      cfg.initial_q = atoll(optarg) * 1000000;
+      break;
+    case 'm':
+      cfg.max_q = atoll(optarg) * 1000000;
+      break;
+    case 'r':
+      ring_slots = round_up_pow2(strtoul(optarg, NULL, 10));
+      if (ring_slots == 0 || optarg[0] == '-') {
+        fprintf(stderr, "mitigated: -r takes 1 to 2^31 slots\n");
+        return 2;
+      }
+      break;
+    case 'c':
+      cfg.queue_capacity = atoi(optarg);
+      break;
+    case 'w':
+      cfg.scheduler = MITIGATE_SCHED_WHEEL;
+      break;
+    case 'p':
+      cfg.policy_path = optarg;
+      break;
+    case 'P':
+      cfg.policy_text = optarg;
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-s socket] [-q initial_q_ms] [-m max_q_ms] "
+              "[-r ring_slots] [-c queue_capacity] [-w] [-p policy_file] "
+              "[-P 'key = value; ...']\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  char err[256];
+  if (mitigate_policy_check(&cfg, err, sizeof(err)) != 0) {
+    fprintf(stderr, "mitigated: %s\n", err);
+    return 2;
+  }
+
+  struct sigaction sa = {.sa_handler = on_signal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  mitigator_t *m = mitigate_create(&cfg);
+  int lsock = listen_on(path);
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (m == NULL || lsock < 0 || epfd < 0) {
+    perror("mitigated");
+    return 1;
+  }
+  // data.ptr NULL is the listening socket; clients are registered twice,
+  // the bell with the client pointer and the socket with it tagged by bit 0
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+  epoll_ctl(epfd, EPOLL_CTL_ADD, lsock, &ev);
+  printf("mitigated: policy %s, listening on %s\n", mitigate_policy_name(),
+         path);
+  fflush(stdout);
+
+  struct channel_map map = {0};
+  while (!stopping) {
+    struct epoll_event events[64];
+    struct client *gone[64]; // closed in this batch, which may name them again
+    int n = epoll_wait(epfd, events, 64, -1), ngone = 0;
+    for (int i = 0; i < n; i++) {
+      uintptr_t data = (uintptr_t)events[i].data.ptr;
+      if (data == 0) {
+        int sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+        struct client *c = sock >= 0 ? client_new(sock, ring_slots) : NULL;
+        if (c == NULL) {
+          if (sock >= 0)
+            close(sock);
+          continue;
+        }
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->submit_bell, &ev);
+        ev.data.ptr = (void *)((uintptr_t)c | 1);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->sock, &ev);
+        // Requests may already be waiting if the client was quick
+        if (client_drain(c, &map, m) != 0 && client_close(c, epfd))
+          gone[ngone++] = c;
+      } else if (data & 1) {
+        // Clients never send anything after connecting: this is a hangup
+        struct client *c = (struct client *)(data & ~(uintptr_t)1);
+        if (client_close(c, epfd))
+          gone[ngone++] = c;
+      } else {
+        struct client *c = (struct client *)data;
+        if (!atomic_load(&c->closed) && client_drain(c, &map, m) != 0 &&
+            client_close(c, epfd))
+          gone[ngone++] = c;
+      }
+    }
+    for (int i = 0; i < ngone; i++) {
+      client_unref(gone[i]);
+    }
+  }
+
+  printf("mitigated: %zu channels, shutting down\n", map.count);
+  unlink(path);
+  close(lsock);
+  close(epfd);
+  atomic_store(&dropping, 1);
+  for (size_t i = 0; i < map.size; i++) {
+    if (map.channels[i] != NULL)
+      mitigate_channel_destroy(map.channels[i]);
+  }
+  free(map.keys);
+  free(map.channels);
+  mitigate_destroy(m);
+  return 0;
+}
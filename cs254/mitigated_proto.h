@@ -0,0 +1,124 @@
+#ifndef MITIGATED_PROTO_H
+#define MITIGATED_PROTO_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Wire format shared by the mitigated daemon and libmitigate-client.
+//
+// A client connects to the daemon's Unix socket and receives one
+// mitigated_hello, carrying three fds as SCM_RIGHTS: a memfd holding the
+// client's mitigated_shm, the submit doorbell and the release doorbell (both
+// eventfds). From then on the socket only tells the daemon when the client
+// goes away; requests and releases travel through the two SPSC rings in the
+// shared memory. A doorbell is only rung when its consumer has said it is
+// going to sleep, so a busy client and daemon make no syscalls at all.
+
+#define MITIGATED_SOCKET "/tmp/mitigated.sock"
+#define MITIGATED_MAGIC 0x4d495447 // "MITG"
+#define MITIGATED_VERSION 2
+
+// mitigated_msg status, on the release ring
+#define MITIGATED_RELEASED 0 // the output's slot has come: send it now
+#define MITIGATED_REJECTED 1 // queue full or daemon stopping: never send it
+
+// One request (client to daemon) or release (daemon to client)
+struct mitigated_msg {
+  uint64_t channel; // daemon-wide channel key, shared by every client
+  uint64_t tag;     // client's own id for the output, echoed on release
+  int64_t time_ns;  // release: when its slot was served, CLOCK_MONOTONIC
+  uint32_t status;  // release: MITIGATED_RELEASED or MITIGATED_REJECTED
+  uint32_t reserved;
+};
+
+// Both sides write the shared memory, so neither trusts what the other
+// leaves there beyond head and tail: each keeps its own copy of the
+// capacity, and masks every index with it.
+struct shm_ring {
+  _Alignas(64) atomic_uint head; // consumer
+  _Alignas(64) atomic_uint tail; // producer
+  _Alignas(64) atomic_int waiting; // consumer is about to sleep on its bell
+};
+
+struct mitigated_shm {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity; // slots in each ring, a power of two; read once
+  struct shm_ring submit;  // client produces, daemon consumes
+  struct shm_ring release; // daemon's release thread produces, client consumes
+  // Followed by capacity submit slots, then capacity release slots
+};
+
+struct mitigated_hello {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t shm_bytes;
+};
+
+static inline size_t mitigated_shm_bytes(unsigned int capacity) {
+  return sizeof(struct mitigated_shm) +
+         2 * (size_t)capacity * sizeof(struct mitigated_msg);
+}
+
+static inline struct mitigated_msg *
+mitigated_slots(struct mitigated_shm *shm, const struct shm_ring *r,
+                unsigned int capacity) {
+  struct mitigated_msg *slots = (struct mitigated_msg *)(shm + 1);
+  return r == &shm->submit ? slots : slots + capacity;
+}
+
+// Producer only. Returns 0, or -1 if the ring is full.
+static inline int shm_ring_push(struct mitigated_shm *shm, struct shm_ring *r,
+                                unsigned int capacity,
+                                const struct mitigated_msg *msg) {
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_acquire);
+  if (tail - head >= capacity)
+    return -1;
+  mitigated_slots(shm, r, capacity)[tail & (capacity - 1)] = *msg;
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+// Consumer only. Returns 0, -1 if the ring is empty, or -2 if the producer
+// claims more than capacity messages, which only a broken peer can do.
+static inline int shm_ring_pop(struct mitigated_shm *shm, struct shm_ring *r,
+                               unsigned int capacity,
+                               struct mitigated_msg *msg) {
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  if (head == tail)
+    return -1;
+  if (tail - head > capacity)
+    return -2;
+  *msg = mitigated_slots(shm, r, capacity)[head & (capacity - 1)];
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return 0;
+}
+
+static inline int shm_ring_empty(struct shm_ring *r) {
+  return atomic_load_explicit(&r->head, memory_order_relaxed) ==
+         atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+// Producer, after a push: whether to ring the consumer's doorbell
+static inline int shm_ring_should_ring(struct shm_ring *r) {
+  atomic_thread_fence(memory_order_seq_cst);
+  return atomic_load_explicit(&r->waiting, memory_order_relaxed) &&
+         atomic_exchange(&r->waiting, 0) == 1;
+}
+
+// Consumer, before sleeping on its doorbell: returns 1 if it may sleep, 0 if
+// something arrived meanwhile
+static inline int shm_ring_arm(struct shm_ring *r) {
+  atomic_store(&r->waiting, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!shm_ring_empty(r)) {
+    atomic_store(&r->waiting, 0);
+    return 0;
+  }
+  return 1;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef PAD_H
+#define PAD_H
+
+#include <stddef.h>
+
+#include "mitigate.h"
+
+// Length-hiding padding. Every output is padded with zeros up to the smallest
+// of an ascending set of bucket sizes that holds it, so on the wire its
+// length only gives away the bucket. Outputs beyond the largest bucket are
+// padded to a multiple of it.
+
+#define PAD_MAX_BUCKETS MITIGATE_PAD_BUCKETS
+
+// Index of the bucket len falls in. Always looks at every bucket, so it
+// takes the same time whatever len is.
+static inline unsigned int pad_bucket(const size_t *buckets, unsigned int n,
+                                      size_t len) {
+  unsigned int bucket = 0;
+  for (unsigned int i = 0; i + 1 < n; i++) {
+    bucket += buckets[i] < len;
+  }
+  return bucket;
+}
+
+// Bytes of zeros that take len up to its bucket
+static inline size_t pad_length(const size_t *buckets, unsigned int n,
+                                size_t len) {
+  size_t size = buckets[pad_bucket(buckets, n, len)];
+  if (len <= size)
+    return size - len;
+  return (size - len % size) % size;
+}
+
+// Returns 0 if the n buckets are usable: 1 to PAD_MAX_BUCKETS sizes, each
+// bigger than the one before
+static inline int pad_check(const size_t *buckets, unsigned int n) {
+  if (n == 0 || n > PAD_MAX_BUCKETS || buckets[0] == 0)
+    return -1;
+  for (unsigned int i = 1; i < n; i++) {
+    if (buckets[i] <= buckets[i - 1])
+      return -1;
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pad.h"
+
+// Bandwidth cost of padding bucket sets (see pad.h) against a histogram of
+// real payload sizes, to tune cfg.pad_buckets. Reads one payload size in
+// bytes per line from stdin; each argument is a comma-separated bucket set.
+//
+// Usage: pad-report BUCKETS... < sizes
+//   e.g. pad-report 256,1024,4096 512,2048,8192 < sizes.txt
+
+struct bucket_set {
+  const char *spec;
+  size_t buckets[PAD_MAX_BUCKETS];
+  unsigned int n;
+  struct mitigate_pad_stats stats[PAD_MAX_BUCKETS];
+};
+
+static int parse_set(const char *spec, struct bucket_set *set) {
+  char *copy = strdup(spec);
+  set->spec = spec;
+  set->n = 0;
+  for (char *tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    if (set->n == PAD_MAX_BUCKETS) {
+      free(copy);
+      return -1;
+    }
+    set->buckets[set->n++] = strtoull(tok, NULL, 10);
+  }
+  free(copy);
+  return pad_check(set->buckets, set->n);
+}
+
+static void report(const struct bucket_set *set) {
+  unsigned long long payload = 0, padded = 0;
+  for (unsigned int i = 0; i < set->n; i++) {
+    payload += set->stats[i].payload_bytes;
+    padded += set->stats[i].padded_bytes;
+  }
+  printf("%s: %llu -> %llu bytes, overhead %.1f%%\n", set->spec, payload,
+         padded, payload > 0 ? 100.0 * (padded - payload) / payload : 0.0);
+  for (unsigned int i = 0; i < set->n; i++) {
+    const struct mitigate_pad_stats *b = &set->stats[i];
+    printf("  %10zu %10llu outputs, overhead %.1f%%\n", set->buckets[i],
+           b->outputs,
+           b->payload_bytes > 0
+               ? 100.0 * (b->padded_bytes - b->payload_bytes) / b->payload_bytes
+               : 0.0);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s BUCKETS... < sizes\n", argv[0]);
+    return 2;
+  }
+  int nsets = argc - 1;
+  struct bucket_set *sets = calloc(nsets, sizeof(*sets));
+  for (int s = 0; s < nsets; s++) {
+    if (parse_set(argv[s + 1], &sets[s]) != 0) {
+      fprintf(stderr, "%s: need 1 to %d ascending sizes\n", argv[s + 1],
+              PAD_MAX_BUCKETS);
+      return 2;
+    }
+  }
+
+  size_t len;
+  while (scanf("%zu", &len) == 1) {
+    for (int s = 0; s < nsets; s++) {
+      struct bucket_set *set = &sets[s];
+      struct mitigate_pad_stats *b =
+          &set->stats[pad_bucket(set->buckets, set->n, len)];
+      b->outputs++;
+      b->payload_bytes += len;
+      b->padded_bytes += len + pad_length(set->buckets, set->n, len);
+    }
+  }
+  for (int s = 0; s < nsets; s++) {
+    report(&sets[s]);
+  }
+  free(sets);
+  return 0;
+}
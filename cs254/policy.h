@@ -0,0 +1,362 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <math.h>
+
+#include "mitigate.h"
+#include "policy_table.h"
+
+// Quantum policies for the release thread. The engine is compiled once per
+// policy with -DMITIGATE_POLICY=POLICY_<NAME>, so each tick calls straight
+// into the inline hooks below instead of through a function pointer.
+//
+// A policy has two hooks, both returning a verb for the log ("doubled",
+// "halved", ...) when they changed q, or NULL when they left it alone:
+//   policy_idle:     a tick found nothing to release
+//   policy_released: a tick released an output, `pending` are still queued
+// plus policy_idle_settled, true when another idle tick would change nothing,
+// which lets the engine park an idle channel without changing its schedule.
+// policy_batch_limit says how many outputs one release slot may carry; the
+// policy hooks then run once per slot, however many outputs it released.
+//
+// A policy that sets POLICY_OBSERVES also sees every output as it leaves the
+// queue, through policy_observe, with the gap since the one queued before
+// it; the engine only timestamps queued outputs for such a policy.
+// POLICY_TABLE takes its schedule from a description compiled at startup
+// (see policy_table.h) instead of from code here.
+
+#define POLICY_RESET 1  // double when idle, reset once the queue drains
+#define POLICY_HALVE 2  // double when idle, halve while a backlog remains
+#define POLICY_DOUBLE 3 // double once per idle stretch, never shrink
+#define POLICY_CAPPED 4 // POLICY_RESET with q never above max_q
+#define POLICY_CHANGEPOINT 5 // POLICY_RESET, retuned at each phase change
+#define POLICY_TABLE 6       // cfg.policy_path and cfg.policy_text
+
+#ifndef MITIGATE_POLICY
+#define MITIGATE_POLICY POLICY_RESET
+#endif
+
+// Doubling saturates here rather than overflowing; by then the next slot is
+// over a century away anyway
+#define POLICY_Q_LIMIT (1LL << 62)
+
+static inline long long policy_double(long long q) {
+  return q >= POLICY_Q_LIMIT / 2 ? POLICY_Q_LIMIT : q * 2;
+}
+
+// Rounds a duration up to the next of the MITIGATE_CALIBRATION_LEVELS
+// quanta, so a quantum chosen from observed timings is one of a small,
+// fixed set
+static inline long long policy_quantize(double ns) {
+  double level = ceil(16 * log2(ns > 1024 ? ns : 1024));
+  if (level > 16 * 40)
+    level = 16 * 40;
+  return (long long)ceil(exp2(level / 16));
+}
+
+// POLICY_CHANGEPOINT: two-sided CUSUM over log2 of the gaps between queued
+// outputs, against the mean gap of the current phase. Each side sums how
+// far the gaps run above (or below) that mean, less POLICY_CP_DRIFT, and
+// confirms a change once its sum passes cfg->change_threshold.
+#define POLICY_CP_DRIFT 0.5 // half an octave either way is the same phase
+#define POLICY_CP_WINDOW 64 // the phase mean weighs this many gaps at most
+
+struct policy_detector {
+  double mean;     // log2 of the phase's mean gap
+  unsigned int n;  // gaps behind mean, up to POLICY_CP_WINDOW
+  double up, down; // the two CUSUM sums
+  // Gaps since each sum last stood at zero: the new phase's, if it alarms
+  double up_sum, down_sum;
+  unsigned int up_n, down_n;
+};
+
+struct policy_state {
+  long long q; // current quantum, in nanoseconds
+  int armed;   // POLICY_DOUBLE: an output went out since the last doubling
+  // POLICY_CHANGEPOINT: the quantum resets return to, and one confirmed by
+  // the detector that the next slot switches to (0 for none)
+  long long base_q, retune_q;
+  struct policy_detector detect;
+  // POLICY_TABLE: the channel's compiled schedule, the level q comes from,
+  // and slots spent at that level (up to table->hold)
+  const struct policy_table *table;
+  unsigned int level, held;
+};
+
+// table is the channel's compiled schedule under POLICY_TABLE, else NULL
+static inline void policy_init(struct policy_state *s,
+                               const struct mitigate_config *cfg,
+                               const struct policy_table *table) {
+  s->table = table;
+  s->level = 0;
+  s->held = 0;
+  s->q = table != NULL ? table->levels[0].q : cfg->initial_q;
+  s->armed = 1;
+  s->base_q = cfg->initial_q;
+  s->retune_q = 0;
+  s->detect = (struct policy_detector){0};
+}
+
+// Same for every policy: the batch size is configured, not adapted
+static inline unsigned int
+policy_batch_limit(const struct policy_state *s,
+                   const struct mitigate_config *cfg) {
+  (void)s;
+  return cfg->batch > 0 ? cfg->batch : 1;
+}
+
+#if MITIGATE_POLICY != POLICY_CHANGEPOINT
+
+#define POLICY_OBSERVES 0
+
+static inline void policy_observe(struct policy_state *s, long long gap_ns,
+                                  const struct mitigate_config *cfg) {
+  (void)s;
+  (void)gap_ns;
+  (void)cfg;
+}
+
+#endif
+
+#if MITIGATE_POLICY == POLICY_RESET
+
+#define POLICY_NAME "reset"
+
+static inline const char *policy_idle(struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  if (s->q >= POLICY_Q_LIMIT)
+    return NULL;
+  s->q = policy_double(s->q);
+  return "doubled";
+}
+
+static inline int policy_idle_settled(const struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  return s->q >= POLICY_Q_LIMIT; // until then every idle tick doubles q
+}
+
+static inline const char *policy_released(struct policy_state *s,
+                                          unsigned int pending,
+                                          const struct mitigate_config *cfg) {
+  if (pending > 0 || s->q == cfg->initial_q)
+    return NULL;
+  s->q = cfg->initial_q;
+  return "reset";
+}
+
+#elif MITIGATE_POLICY == POLICY_HALVE
+
+#define POLICY_NAME "halve"
+
+static inline const char *policy_idle(struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  if (s->q >= POLICY_Q_LIMIT)
+    return NULL;
+  s->q = policy_double(s->q);
+  return "doubled";
+}
+
+static inline int policy_idle_settled(const struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  return s->q >= POLICY_Q_LIMIT; // until then every idle tick doubles q
+}
+
+static inline const char *policy_released(struct policy_state *s,
+                                          unsigned int pending,
+                                          const struct mitigate_config *cfg) {
+  (void)cfg;
+  // Stop at 1 ns, where an integer quantum would otherwise reach zero
+  if (pending == 0 || s->q <= 1)
+    return NULL;
+  s->q /= 2;
+  return "halved";
+}
+
+#elif MITIGATE_POLICY == POLICY_DOUBLE
+
+#define POLICY_NAME "double"
+
+static inline const char *policy_idle(struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  if (!s->armed)
+    return NULL;
+  s->q = policy_double(s->q);
+  s->armed = 0;
+  return "doubled";
+}
+
+static inline int policy_idle_settled(const struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  return !s->armed;
+}
+
+static inline const char *policy_released(struct policy_state *s,
+                                          unsigned int pending,
+                                          const struct mitigate_config *cfg) {
+  (void)pending;
+  (void)cfg;
+  s->armed = 1;
+  return NULL;
+}
+
+#elif MITIGATE_POLICY == POLICY_CAPPED
+
+#define POLICY_NAME "capped"
+
+static inline const char *policy_idle(struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  if (s->q >= cfg->max_q)
+    return NULL;
+  s->q = policy_double(s->q);
+  if (s->q > cfg->max_q)
+    s->q = cfg->max_q; // Cap q to prevent excessive delay
+  return "doubled";
+}
+
+static inline int policy_idle_settled(const struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  return s->q >= cfg->max_q;
+}
+
+static inline const char *policy_released(struct policy_state *s,
+                                          unsigned int pending,
+                                          const struct mitigate_config *cfg) {
+  if (pending > 0 || s->q == cfg->initial_q)
+    return NULL;
+  s->q = cfg->initial_q;
+  return "reset";
+}
+
+#elif MITIGATE_POLICY == POLICY_CHANGEPOINT
+
+#define POLICY_NAME "changepoint"
+#define POLICY_OBSERVES 1
+
+static inline void policy_observe(struct policy_state *s, long long gap_ns,
+                                  const struct mitigate_config *cfg) {
+  struct policy_detector *d = &s->detect;
+  // Back-to-back outputs count as 1 us apart, which keeps the log finite
+  double x = log2(gap_ns > 1000 ? gap_ns : 1000);
+  if (d->n == 0) {
+    // The first gap starts the first phase, and ends initial_q's epoch
+    d->mean = x;
+    d->n = 1;
+    s->retune_q = policy_quantize(exp2(x + POLICY_CP_DRIFT));
+    return;
+  }
+  d->up += x - d->mean - POLICY_CP_DRIFT;
+  d->down += d->mean - x - POLICY_CP_DRIFT;
+  if (d->up <= 0) {
+    d->up = d->up_sum = d->up_n = 0;
+  } else {
+    d->up_sum += x;
+    d->up_n++;
+  }
+  if (d->down <= 0) {
+    d->down = d->down_sum = d->down_n = 0;
+  } else {
+    d->down_sum += x;
+    d->down_n++;
+  }
+
+  if (d->up > cfg->change_threshold || d->down > cfg->change_threshold) {
+    // The new phase's mean is estimated from the gaps that built the alarm
+    int up = d->up > cfg->change_threshold;
+    d->mean = up ? d->up_sum / d->up_n : d->down_sum / d->down_n;
+    d->n = up ? d->up_n : d->down_n;
+    d->up = d->up_sum = d->up_n = 0;
+    d->down = d->down_sum = d->down_n = 0;
+    // Half an octave over the mean gap, the most it drifts within a phase:
+    // slots then seldom find the queue empty, so the phase is one epoch
+    s->retune_q = policy_quantize(exp2(d->mean + POLICY_CP_DRIFT));
+    return;
+  }
+  if (d->n < POLICY_CP_WINDOW)
+    d->n++;
+  d->mean += (x - d->mean) / d->n;
+}
+
+static inline const char *policy_idle(struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  if (s->q >= POLICY_Q_LIMIT)
+    return NULL;
+  s->q = policy_double(s->q);
+  return "doubled";
+}
+
+static inline int policy_idle_settled(const struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  return s->q >= POLICY_Q_LIMIT; // until then every idle tick doubles q
+}
+
+static inline const char *policy_released(struct policy_state *s,
+                                          unsigned int pending,
+                                          const struct mitigate_config *cfg) {
+  (void)cfg;
+  // A confirmed phase change starts its epoch straight away, whatever the
+  // queue holds, rather than after a run of doublings or halvings
+  if (s->retune_q > 0) {
+    s->q = s->base_q = s->retune_q;
+    s->retune_q = 0;
+    return "retuned";
+  }
+  if (pending > 0 || s->q == s->base_q)
+    return NULL;
+  s->q = s->base_q;
+  return "reset";
+}
+
+#elif MITIGATE_POLICY == POLICY_TABLE
+
+#define POLICY_NAME "table"
+
+// Moves to level next, once the current one has been held long enough
+static inline const char *policy_table_move(struct policy_state *s,
+                                            unsigned int next,
+                                            const char *verb) {
+  if (s->held < s->table->hold)
+    s->held++;
+  if (next == s->level || next >= s->table->nlevels ||
+      s->held < s->table->hold)
+    return NULL;
+  s->level = next;
+  s->held = 0;
+  s->q = s->table->levels[next].q;
+  return verb;
+}
+
+static inline const char *policy_idle(struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  return policy_table_move(s, s->table->levels[s->level].idle, "grew");
+}
+
+static inline int policy_idle_settled(const struct policy_state *s,
+                                      const struct mitigate_config *cfg) {
+  (void)cfg;
+  return s->table->levels[s->level].idle == s->level &&
+         s->held >= s->table->hold;
+}
+
+static inline const char *policy_released(struct policy_state *s,
+                                          unsigned int pending,
+                                          const struct mitigate_config *cfg) {
+  (void)cfg;
+  const struct policy_level *l = &s->table->levels[s->level];
+  return policy_table_move(s, pending > 0 ? l->backlog : l->drained,
+                           s->table->shrink_verb);
+}
+
+#else
+#error "MITIGATE_POLICY must be one of the POLICY_* values"
+#endif
+
+#endif
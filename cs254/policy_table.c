@@ -0,0 +1,307 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "policy.h"
+#include "policy_table.h"
+
+enum grow_kind { GROW_MUL, GROW_ADD, GROW_NONE };
+enum shrink_kind { SHRINK_RESET, SHRINK_HALVE, SHRINK_NONE };
+enum shrink_on { SHRINK_ON_DRAINED, SHRINK_ON_BACKLOG, SHRINK_ON_ANY };
+
+// A description as parsed, before it is compiled into levels
+struct policy_spec {
+  long long initial_q, max_q;
+  enum grow_kind grow;
+  double factor;   // GROW_MUL
+  long long step;  // GROW_ADD
+  enum shrink_kind shrink;
+  enum shrink_on shrink_on;
+  long long hold, batch;
+};
+
+// Parses a duration with an optional ns, us, ms or s unit into *ns
+static int parse_duration(const char *s, long long *ns) {
+  char *end;
+  errno = 0;
+  double v = strtod(s, &end);
+  if (end == s || errno != 0 || v < 0)
+    return -1;
+  double scale = 1;
+  if (strcmp(end, "s") == 0)
+    scale = 1e9;
+  else if (strcmp(end, "ms") == 0)
+    scale = 1e6;
+  else if (strcmp(end, "us") == 0)
+    scale = 1e3;
+  else if (*end != '\0' && strcmp(end, "ns") != 0)
+    return -1;
+  if (v * scale >= POLICY_Q_LIMIT)
+    return -1;
+  *ns = (long long)(v * scale);
+  return 0;
+}
+
+static int parse_count(const char *s, long long *n) {
+  char *end;
+  errno = 0;
+  *n = strtoll(s, &end, 10);
+  return end == s || *end != '\0' || errno != 0 || *n < 0 ? -1 : 0;
+}
+
+// Applies one `key = value` line, already stripped of comments and outer
+// blanks. Returns NULL, or what is wrong with it.
+static const char *parse_line(struct policy_spec *spec, char *line) {
+  char *eq = strchr(line, '=');
+  if (eq == NULL)
+    return "expected key = value";
+  char *key = line, *value = eq + 1;
+  for (*eq = '\0'; eq > key && isspace((unsigned char)eq[-1]); eq--) {
+    eq[-1] = '\0';
+  }
+  while (isspace((unsigned char)*value)) {
+    value++;
+  }
+
+  if (strcmp(key, "initial_q") == 0) {
+    if (parse_duration(value, &spec->initial_q) != 0 || spec->initial_q < 1)
+      return "initial_q must be a positive duration";
+  } else if (strcmp(key, "max_q") == 0) {
+    if (strcmp(value, "none") == 0)
+      spec->max_q = POLICY_Q_LIMIT;
+    else if (parse_duration(value, &spec->max_q) != 0)
+      return "max_q must be a duration or none";
+  } else if (strcmp(key, "grow") == 0) {
+    char *end;
+    if (strcmp(value, "none") == 0) {
+      spec->grow = GROW_NONE;
+    } else if (value[0] == 'x') {
+      spec->factor = strtod(value + 1, &end);
+      if (end == value + 1 || *end != '\0' || !(spec->factor > 1))
+        return "grow factor must be above 1";
+      spec->grow = GROW_MUL;
+    } else if (value[0] == '+') {
+      if (parse_duration(value + 1, &spec->step) != 0 || spec->step < 1)
+        return "grow step must be a positive duration";
+      spec->grow = GROW_ADD;
+    } else {
+      return "grow must be x<factor>, +<duration> or none";
+    }
+  } else if (strcmp(key, "shrink") == 0) {
+    if (strcmp(value, "reset") == 0)
+      spec->shrink = SHRINK_RESET;
+    else if (strcmp(value, "halve") == 0)
+      spec->shrink = SHRINK_HALVE;
+    else if (strcmp(value, "none") == 0)
+      spec->shrink = SHRINK_NONE;
+    else
+      return "shrink must be reset, halve or none";
+  } else if (strcmp(key, "shrink_on") == 0) {
+    if (strcmp(value, "drained") == 0)
+      spec->shrink_on = SHRINK_ON_DRAINED;
+    else if (strcmp(value, "backlog") == 0)
+      spec->shrink_on = SHRINK_ON_BACKLOG;
+    else if (strcmp(value, "any") == 0)
+      spec->shrink_on = SHRINK_ON_ANY;
+    else
+      return "shrink_on must be drained, backlog or any";
+  } else if (strcmp(key, "hold") == 0) {
+    if (parse_count(value, &spec->hold) != 0 || spec->hold < 1 ||
+        spec->hold > 1000000000)
+      return "hold must be a count of slots, at least 1";
+  } else if (strcmp(key, "batch") == 0) {
+    if (parse_count(value, &spec->batch) != 0 || spec->batch > 1000000000)
+      return "batch must be a count of outputs";
+  } else {
+    return "unknown key";
+  }
+  return NULL;
+}
+
+// Parses a whole description, in place. Returns 0, or -1 with err set.
+static int parse_text(struct policy_spec *spec, char *text, const char *where,
+                      char *err, size_t errlen) {
+  int lineno = 1;
+  for (char *p = text; *p != '\0'; lineno++) {
+    size_t len = strcspn(p, "\n");
+    char *next = p[len] != '\0' ? p + len + 1 : p + len;
+    p[len] = '\0';
+    // Statements on one line are separated by ';', comments run to its end
+    char *hash = strchr(p, '#');
+    if (hash != NULL)
+      *hash = '\0';
+    char *save;
+    for (char *stmt = strtok_r(p, ";", &save); stmt != NULL;
+         stmt = strtok_r(NULL, ";", &save)) {
+      while (isspace((unsigned char)*stmt)) {
+        stmt++;
+      }
+      char *end = stmt + strlen(stmt);
+      while (end > stmt && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+      }
+      if (*stmt == '\0')
+        continue;
+      const char *problem = parse_line(spec, stmt);
+      if (problem != NULL) {
+        snprintf(err, errlen, "%s line %d: %s", where, lineno, problem);
+        return -1;
+      }
+    }
+    p = next;
+  }
+  return 0;
+}
+
+static char *read_file(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return NULL;
+  size_t len = 0, cap = 4096;
+  char *buf = malloc(cap);
+  size_t n;
+  while (buf != NULL && (n = fread(buf + len, 1, cap - len - 1, f)) > 0) {
+    len += n;
+    if (cap - len == 1) {
+      char *bigger = realloc(buf, cap * 2);
+      if (bigger == NULL)
+        free(buf);
+      buf = bigger;
+      cap *= 2;
+    }
+  }
+  if (buf != NULL && ferror(f)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  if (buf != NULL)
+    buf[len] = '\0';
+  return buf;
+}
+
+// Lays out the levels: each grows into the next until max_q, and shrinks
+// into level 0 or the highest at or below half its quantum
+static int compile(struct policy_table *t, const struct policy_spec *spec,
+                   char *err, size_t errlen) {
+  long long q[POLICY_TABLE_MAX_LEVELS];
+  unsigned int n = 0;
+  q[n++] = spec->initial_q < spec->max_q ? spec->initial_q : spec->max_q;
+  for (;;) {
+    long long prev = q[n - 1], next = prev;
+    if (spec->grow == GROW_MUL)
+      next = prev * spec->factor < POLICY_Q_LIMIT ? prev * spec->factor
+                                                  : POLICY_Q_LIMIT;
+    else if (spec->grow == GROW_ADD)
+      next = prev < POLICY_Q_LIMIT - spec->step ? prev + spec->step
+                                                : POLICY_Q_LIMIT;
+    if (next > spec->max_q)
+      next = spec->max_q;
+    if (next <= prev)
+      break;
+    if (n == POLICY_TABLE_MAX_LEVELS) {
+      snprintf(err, errlen, "schedule needs more than %d levels; raise grow "
+               "or lower max_q", POLICY_TABLE_MAX_LEVELS);
+      return -1;
+    }
+    q[n++] = next;
+  }
+
+  t->levels = malloc(n * sizeof(*t->levels));
+  if (t->levels == NULL) {
+    snprintf(err, errlen, "%s", strerror(errno));
+    return -1;
+  }
+  for (unsigned int i = 0, half = 0; i < n; i++) {
+    while (half + 1 < i && q[half + 1] <= q[i] / 2) {
+      half++;
+    }
+    unsigned int shrunk = spec->shrink == SHRINK_RESET   ? 0
+                          : spec->shrink == SHRINK_HALVE ? half
+                                                         : i;
+    t->levels[i] = (struct policy_level){
+        .q = q[i],
+        .idle = i + 1 < n ? i + 1 : i,
+        .drained = spec->shrink_on != SHRINK_ON_BACKLOG ? shrunk : i,
+        .backlog = spec->shrink_on != SHRINK_ON_DRAINED ? shrunk : i,
+    };
+  }
+  t->nlevels = n;
+  t->hold = spec->hold;
+  t->batch = spec->batch;
+  t->shrink_verb = spec->shrink == SHRINK_HALVE ? "halved" : "reset";
+  return 0;
+}
+
+// Compiles, keeping a copy of the description for policy_table_rebase
+static int build(struct policy_table *t, const struct policy_spec *spec,
+                 char *err, size_t errlen) {
+  memset(t, 0, sizeof(*t));
+  t->spec = malloc(sizeof(*t->spec));
+  if (t->spec == NULL) {
+    snprintf(err, errlen, "%s", strerror(errno));
+    return -1;
+  }
+  *t->spec = *spec;
+  if (compile(t, spec, err, errlen) != 0) {
+    policy_table_free(t);
+    return -1;
+  }
+  return 0;
+}
+
+int policy_table_compile(struct policy_table *t, const char *path,
+                         const char *text, const struct mitigate_config *cfg,
+                         char *err, size_t errlen) {
+  struct policy_spec spec = {
+      .initial_q = cfg->initial_q > 0 ? cfg->initial_q : 1,
+      .max_q = POLICY_Q_LIMIT,
+      .grow = GROW_MUL,
+      .factor = 2,
+      .shrink = SHRINK_RESET,
+      .shrink_on = SHRINK_ON_DRAINED,
+      .hold = 1,
+      .batch = 0,
+  };
+  memset(t, 0, sizeof(*t));
+  if (path != NULL) {
+    char *buf = read_file(path);
+    if (buf == NULL) {
+      snprintf(err, errlen, "%s: %s", path, strerror(errno));
+      return -1;
+    }
+    int rc = parse_text(&spec, buf, path, err, errlen);
+    free(buf);
+    if (rc != 0)
+      return -1;
+  }
+  if (text != NULL) {
+    char *buf = strdup(text);
+    if (buf == NULL) {
+      snprintf(err, errlen, "%s", strerror(errno));
+      return -1;
+    }
+    int rc = parse_text(&spec, buf, "policy", err, errlen);
+    free(buf);
+    if (rc != 0)
+      return -1;
+  }
+  return build(t, &spec, err, errlen);
+}
+
+int policy_table_rebase(struct policy_table *t, const struct policy_table *base,
+                        long long initial_q, char *err, size_t errlen) {
+  struct policy_spec spec = *base->spec;
+  spec.initial_q = initial_q > 0 ? initial_q : 1;
+  return build(t, &spec, err, errlen);
+}
+
+void policy_table_free(struct policy_table *t) {
+  free(t->levels);
+  free(t->spec);
+  t->levels = NULL;
+  t->spec = NULL;
+  t->nlevels = 0;
+}
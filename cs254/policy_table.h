@@ -0,0 +1,66 @@
+#ifndef POLICY_TABLE_H
+#define POLICY_TABLE_H
+
+#include <stddef.h>
+
+#include "mitigate.h"
+
+// Schedule for POLICY_TABLE, described in a small text format and compiled
+// once, at mitigate_create, into a dense array of levels. A level is a
+// quantum and the level each kind of slot moves the channel to next, so the
+// release thread's decision per slot is one bounds-checked array read.
+// Channels that start from an initial_q of their own get a copy rebased on
+// it when they are created.
+//
+// The description is `key = value` lines, or `;`-separated on one line, with
+// `#` comments. Every key is optional:
+//   initial_q = 100ms      first quantum (default cfg.initial_q), for
+//                          channels without their own; durations
+//                          take ns, us, ms or s, and are ns without a unit
+//   grow = x2              on an idle slot: multiply q (x<factor>), add to it
+//                          (+<duration>) or keep it (none)
+//   max_q = 16s            growth stops here (default none)
+//   shrink = reset         when shrinking: back to initial_q (reset), to half
+//                          of q or below (halve), or not at all (none)
+//   shrink_on = drained    shrink after a slot that emptied the queue
+//                          (drained), left a backlog (backlog), or either (any)
+//   hold = 1               slots a quantum is kept before it may change, so
+//                          epochs last at least this long
+//   batch = 16             outputs per slot (default cfg.batch)
+// The defaults make it POLICY_RESET.
+
+#define POLICY_TABLE_MAX_LEVELS 4096
+
+struct policy_spec;
+
+struct policy_level {
+  long long q;          // quantum, in ns
+  unsigned int idle;    // next level after a slot with nothing to release
+  unsigned int drained; // after a slot that emptied the queue
+  unsigned int backlog; // after a slot that left outputs queued
+};
+
+struct policy_table {
+  struct policy_level *levels; // levels[0] has initial_q
+  unsigned int nlevels;
+  unsigned int hold;  // >= 1
+  unsigned int batch; // 0 for cfg.batch
+  const char *shrink_verb;
+  struct policy_spec *spec; // the description, for policy_table_rebase
+};
+
+// Compiles the description in the file at path, then the one in text (for
+// command-line overrides); either may be NULL. Returns 0, or -1 with a
+// message naming the offending line in err.
+int policy_table_compile(struct policy_table *t, const char *path,
+                         const char *text, const struct mitigate_config *cfg,
+                         char *err, size_t errlen);
+
+// Compiles base's description again into t, starting from initial_q instead
+// of its own. Returns 0, or -1 with what is wrong in err.
+int policy_table_rebase(struct policy_table *t, const struct policy_table *base,
+                        long long initial_q, char *err, size_t errlen);
+
+void policy_table_free(struct policy_table *t);
+
+#endif
@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "release_timer.h"
+#include "slab.h"
+
+// Batch scratch mapped up front; a bigger batch grows it once and keeps it
+#define POOL_SCRATCH_BYTES (64 * 1024)
+
+struct pool {
+  pthread_t *threads;
+  int nworkers;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond; // a new batch was posted, or shutdown
+  pthread_cond_t done_cond; // an output became ready, or a worker went idle
+
+  // Current batch, written under lock before generation is bumped
+  int (*target_function)(int);
+  unsigned long long *secrets;
+  int secrets_size;
+  int *outputs;
+  long long *durations; // ns each evaluation took
+  int *ready;
+  int next;   // next index to hand to a worker
+  int active; // workers still inside the current batch
+
+  unsigned long generation;
+  int shutdown;
+
+  // pool_submit jobs waiting for a worker, oldest first
+  struct pool_job *jobs;
+  struct pool_job *jobs_tail;
+
+  struct arena scratch; // outputs and ready flags, reset for every batch
+};
+
+static void *pool_worker(void *arg) {
+  struct pool *p = arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&p->lock);
+  while (1) {
+    while (p->generation == seen && p->jobs == NULL && !p->shutdown) {
+      pthread_cond_wait(&p->work_cond, &p->lock);
+    }
+    if (p->shutdown)
+      break;
+    if (p->jobs != NULL) {
+      struct pool_job *job = p->jobs;
+      p->jobs = job->next;
+      pthread_mutex_unlock(&p->lock);
+      job->run(job);
+      pthread_mutex_lock(&p->lock);
+      continue;
+    }
+    seen = p->generation;
+    p->active++;
+
+    // Claim indices one at a time so a slow secret doesn't hold back a whole
+    // chunk of fast ones behind it
+    while (p->next < p->secrets_size) {
+      int i = p->next++;
+      pthread_mutex_unlock(&p->lock);
+      long long start = release_timer_now_ns();
+      int output = p->target_function(p->secrets[i]);
+      long long ns = release_timer_now_ns() - start;
+      pthread_mutex_lock(&p->lock);
+      p->outputs[i] = output;
+      p->durations[i] = ns;
+      p->ready[i] = 1;
+      pthread_cond_broadcast(&p->done_cond);
+    }
+
+    p->active--;
+    pthread_cond_broadcast(&p->done_cond);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+struct pool *pool_create(int nworkers) {
+  if (nworkers <= 0) {
+    nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers <= 0)
+      nworkers = 1;
+  }
+
+  struct pool *p = calloc(1, sizeof(*p));
+  if (p == NULL)
+    return NULL;
+  p->threads = malloc(nworkers * sizeof(pthread_t));
+  if (p->threads == NULL || arena_init(&p->scratch, POOL_SCRATCH_BYTES) != 0) {
+    free(p->threads);
+    free(p);
+    return NULL;
+  }
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->work_cond, NULL);
+  pthread_cond_init(&p->done_cond, NULL);
+
+  for (int i = 0; i < nworkers; i++) {
+    if (pthread_create(&p->threads[i], NULL, pool_worker, p) != 0) {
+      p->nworkers = i;
+      pool_destroy(p);
+      return NULL;
+    }
+  }
+  p->nworkers = nworkers;
+  return p;
+}
+
+void pool_destroy(struct pool *p) {
+  pthread_mutex_lock(&p->lock);
+  p->shutdown = 1;
+  pthread_cond_broadcast(&p->work_cond);
+  pthread_mutex_unlock(&p->lock);
+
+  for (int i = 0; i < p->nworkers; i++) {
+    pthread_join(p->threads[i], NULL);
+  }
+  pthread_cond_destroy(&p->done_cond);
+  pthread_cond_destroy(&p->work_cond);
+  pthread_mutex_destroy(&p->lock);
+  arena_destroy(&p->scratch);
+  free(p->threads);
+  free(p);
+}
+
+void pool_submit(struct pool *p, struct pool_job *job) {
+  job->next = NULL;
+  pthread_mutex_lock(&p->lock);
+  if (p->jobs == NULL)
+    p->jobs = job;
+  else
+    p->jobs_tail->next = job;
+  p->jobs_tail = job;
+  pthread_cond_signal(&p->work_cond);
+  pthread_mutex_unlock(&p->lock);
+}
+
+int pool_map_ordered(struct pool *p, int (*target_function)(int),
+                     unsigned long long secrets[], int secrets_size,
+                     void (*emit)(int output, long long ns, void *ctx),
+                     void *ctx) {
+  // All three arrays come from the pool's prefaulted scratch, not malloc
+  size_t bytes = secrets_size * sizeof(int);
+  size_t ns_bytes = secrets_size * sizeof(long long);
+  if (arena_reserve(&p->scratch, 2 * bytes + ns_bytes + 3 * SLAB_ALIGN) != 0)
+    return -1;
+  arena_reset(&p->scratch);
+  int *outputs = arena_alloc(&p->scratch, bytes);
+  long long *durations = arena_alloc(&p->scratch, ns_bytes);
+  int *ready = arena_alloc(&p->scratch, bytes);
+  memset(ready, 0, bytes);
+
+  pthread_mutex_lock(&p->lock);
+  p->target_function = target_function;
+  p->secrets = secrets;
+  p->secrets_size = secrets_size;
+  p->outputs = outputs;
+  p->durations = durations;
+  p->ready = ready;
+  p->next = 0;
+  p->generation++;
+  pthread_cond_broadcast(&p->work_cond);
+
+  // Reorder stage: emit strictly in index order, outside the lock
+  for (int emitted = 0; emitted < secrets_size; emitted++) {
+    while (!ready[emitted]) {
+      pthread_cond_wait(&p->done_cond, &p->lock);
+    }
+    int output = outputs[emitted];
+    long long ns = durations[emitted];
+    pthread_mutex_unlock(&p->lock);
+    emit(output, ns, ctx);
+    pthread_mutex_lock(&p->lock);
+  }
+
+  // Don't free the batch while a worker is still on its way out of it
+  while (p->active > 0) {
+    pthread_cond_wait(&p->done_cond, &p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+  return 0;
+}
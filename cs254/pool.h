@@ -0,0 +1,39 @@
+#ifndef POOL_H
+#define POOL_H
+
+// Worker pool that evaluates target_function over a batch of secrets on
+// several cores at once. A reorder stage on the calling thread hands the
+// outputs on in submission order, so whatever consumes them (the release
+// queue) sees exactly the sequence a serial loop would have produced.
+
+struct pool;
+
+// A single asynchronous task, embedded in whatever it works on
+struct pool_job {
+  void (*run)(struct pool_job *job);
+  struct pool_job *next;
+};
+
+// Starts nworkers threads, or one per online CPU when nworkers <= 0.
+// Returns NULL on failure.
+struct pool *pool_create(int nworkers);
+
+// Stops and joins the workers. No batch may be running.
+void pool_destroy(struct pool *p);
+
+// Queues job->run(job) for the next free worker and returns at once. Jobs
+// start in submission order, alongside any batch.
+void pool_submit(struct pool *p, struct pool_job *job);
+
+// Evaluates target_function(secrets[i]) for every i across the workers and
+// calls emit(output, ns, ctx) on the calling thread in index order, as soon
+// as each output and all the ones before it are ready; ns is how long the
+// evaluation took. Returns once every output
+// has been emitted: 0 on success, -1 if the batch could not be allocated.
+// One batch at a time; its bookkeeping reuses the pool's own scratch memory.
+int pool_map_ordered(struct pool *p, int (*target_function)(int),
+                     unsigned long long secrets[], int secrets_size,
+                     void (*emit)(int output, long long ns, void *ctx),
+                     void *ctx);
+
+#endif
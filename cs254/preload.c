@@ -0,0 +1,394 @@
+#define _GNU_SOURCE // RTLD_NEXT
+
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mitigate.h"
+
+// libmitigate-preload.so: mitigates the output timing of an unmodified
+// program. Loaded with LD_PRELOAD, it intercepts write, send, sendmsg and
+// writev on the selected descriptors and holds each call until a release
+// slot of the descriptor's channel, then makes the real call and returns its
+// result. Every selected descriptor gets its own channel, with the
+// same epochs and quantum changes as black_box_mitigator (the policy is the
+// one the library was built with, PRELOAD_POLICY in the Makefile).
+//
+// Environment:
+//   MITIGATE_FDS       comma-separated descriptor numbers
+//   MITIGATE_ADDR      comma-separated socket addresses, matched against
+//                      either end of a socket: ip:port, [ip6]:port, :port
+//                      (any address), ip (any port) or a Unix socket path
+//   MITIGATE_Q_MS      initial quantum in ms (default 100)
+//   MITIGATE_MAX_Q_MS  quantum cap in ms (default 16000)
+//
+// Unselected descriptors cost one table lookup per call. A descriptor is
+// classified on its first write and forgotten on close, which also drops its
+// channel, so a reused number starts a fresh epoch history. The slot only
+// wakes the caller, which makes the real call on its own thread: a blocking
+// descriptor whose peer stops reading holds up its own callers, never the
+// release thread. glibc's stdio writes through its own internal write, which
+// no preload can see.
+
+#define PRELOAD_MAX_FDS 65536
+#define PRELOAD_MAX_FILTERS 16
+
+enum fd_state { FD_UNKNOWN, FD_PLAIN, FD_MITIGATED };
+
+struct addr_filter {
+  int family; // AF_INET, AF_INET6 or AF_UNIX
+  int any_addr;
+  unsigned char addr[16];
+  in_port_t port; // network order, 0 for any
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+};
+
+struct fd_channel {
+  pthread_mutex_t lock; // one submitter per channel at a time
+  pthread_cond_t idle;  // signalled when inflight drops to 0
+  mitigate_channel_t *ch;
+  int inflight; // calls submitted whose real call hasn't returned yet
+};
+
+enum held_op { HELD_WRITE, HELD_SEND, HELD_SENDMSG, HELD_WRITEV };
+
+// A call waiting on the stack of its thread for its release slot
+struct held_call {
+  enum held_op op;
+  int fd;
+  int flags;
+  const void *buf;
+  size_t len;
+  const struct iovec *iov;
+  int iovcnt;
+  const struct msghdr *msg;
+
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  int done;
+};
+
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_send)(int, const void *, size_t, int);
+static ssize_t (*real_sendmsg)(int, const struct msghdr *, int);
+static ssize_t (*real_writev)(int, const struct iovec *, int);
+static int (*real_close)(int);
+
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static int selecting; // any filter given at all
+static unsigned char fd_listed[PRELOAD_MAX_FDS];
+static struct addr_filter filters[PRELOAD_MAX_FILTERS];
+static int nfilters;
+static struct mitigate_config engine_cfg;
+
+static _Atomic unsigned char fd_states[PRELOAD_MAX_FDS];
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fd_channel *fd_channels[PRELOAD_MAX_FDS];
+static mitigator_t *engine; // created on the first mitigated call
+
+static int parse_filter(const char *s, size_t len, struct addr_filter *f) {
+  char buf[128];
+  if (len == 0 || len >= sizeof(buf))
+    return -1;
+  memcpy(buf, s, len);
+  buf[len] = '\0';
+  memset(f, 0, sizeof(*f));
+
+  if (buf[0] == '/') {
+    if (len >= sizeof(f->path))
+      return -1;
+    f->family = AF_UNIX;
+    strcpy(f->path, buf);
+    return 0;
+  }
+  char *host = buf;
+  char *port = NULL;
+  if (buf[0] == '[') {
+    char *end = strchr(buf, ']');
+    if (end == NULL)
+      return -1;
+    *end = '\0';
+    host = buf + 1;
+    if (end[1] == ':')
+      port = end + 2;
+    f->family = AF_INET6;
+  } else if (strchr(buf, ':') == strrchr(buf, ':')) {
+    port = strchr(buf, ':');
+    if (port != NULL)
+      *port++ = '\0';
+    f->family = AF_INET;
+  } else {
+    f->family = AF_INET6; // bare IPv6 address, any port
+  }
+  if (port != NULL && *port != '\0')
+    f->port = htons(atoi(port));
+  f->any_addr = *host == '\0';
+  if (!f->any_addr && inet_pton(f->family, host, f->addr) != 1)
+    return -1;
+  return 0;
+}
+
+static int filter_match(const struct addr_filter *f,
+                        const struct sockaddr_storage *ss) {
+  if (f->any_addr && f->family != AF_UNIX &&
+      (ss->ss_family == AF_INET || ss->ss_family == AF_INET6)) {
+    // ":port" matches both address families
+    in_port_t port = ss->ss_family == AF_INET
+                         ? ((const struct sockaddr_in *)ss)->sin_port
+                         : ((const struct sockaddr_in6 *)ss)->sin6_port;
+    return f->port == 0 || f->port == port;
+  }
+  if (ss->ss_family != f->family)
+    return 0;
+  switch (f->family) {
+  case AF_INET: {
+    const struct sockaddr_in *in = (const struct sockaddr_in *)ss;
+    return (f->port == 0 || f->port == in->sin_port) &&
+           memcmp(f->addr, &in->sin_addr, 4) == 0;
+  }
+  case AF_INET6: {
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)ss;
+    return (f->port == 0 || f->port == in6->sin6_port) &&
+           memcmp(f->addr, &in6->sin6_addr, 16) == 0;
+  }
+  default:
+    return strcmp(f->path, ((const struct sockaddr_un *)ss)->sun_path) == 0;
+  }
+}
+
+static double env_ms(const char *name, double fallback) {
+  const char *s = getenv(name);
+  return s != NULL ? atof(s) : fallback;
+}
+
+// After fork only the calling thread exists: start again with no engine and
+// no channels, leaking the parent's, and classify descriptors afresh
+static void preload_atfork_child(void) {
+  pthread_mutex_init(&table_lock, NULL);
+  engine = NULL;
+  for (int fd = 0; fd < PRELOAD_MAX_FDS; fd++) {
+    if (fd_channels[fd] != NULL) {
+      pthread_mutex_init(&fd_channels[fd]->lock, NULL);
+      pthread_cond_init(&fd_channels[fd]->idle, NULL);
+      fd_channels[fd]->ch = NULL;
+      fd_channels[fd]->inflight = 0;
+    }
+    atomic_store_explicit(&fd_states[fd], FD_UNKNOWN, memory_order_relaxed);
+  }
+}
+
+static void preload_setup(void) {
+  real_write = dlsym(RTLD_NEXT, "write");
+  real_send = dlsym(RTLD_NEXT, "send");
+  real_sendmsg = dlsym(RTLD_NEXT, "sendmsg");
+  real_writev = dlsym(RTLD_NEXT, "writev");
+  real_close = dlsym(RTLD_NEXT, "close");
+
+  const char *fds = getenv("MITIGATE_FDS");
+  for (const char *s = fds; s != NULL && *s != '\0';) {
+    int fd = atoi(s);
+    if (fd >= 0 && fd < PRELOAD_MAX_FDS) {
+      fd_listed[fd] = 1;
+      selecting = 1;
+    }
+    s = strchr(s, ',');
+    s = s != NULL ? s + 1 : NULL;
+  }
+  const char *addrs = getenv("MITIGATE_ADDR");
+  for (const char *s = addrs; s != NULL && *s != '\0';) {
+    size_t len = strcspn(s, ",");
+    if (nfilters < PRELOAD_MAX_FILTERS &&
+        parse_filter(s, len, &filters[nfilters]) == 0) {
+      nfilters++;
+      selecting = 1;
+    }
+    s = s[len] == ',' ? s + len + 1 : NULL;
+  }
+
+  mitigate_config_init(&engine_cfg);
+  engine_cfg.initial_q = env_ms("MITIGATE_Q_MS", 100) * 1000000;
+  engine_cfg.max_q = env_ms("MITIGATE_MAX_Q_MS", 16000) * 1000000;
+  engine_cfg.nworkers = 1; // nothing is evaluated on the pool
+  engine_cfg.log_releases = 0;
+  engine_cfg.out_fd = -1; // the released caller makes the real call
+  pthread_atfork(NULL, NULL, preload_atfork_child);
+}
+
+static int fd_classify(int fd) {
+  int mitigated = fd_listed[fd];
+  for (int side = 0; side < 2 && !mitigated && nfilters > 0; side++) {
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    memset(&ss, 0, sizeof(ss));
+    int ret = side == 0 ? getsockname(fd, (struct sockaddr *)&ss, &len)
+                        : getpeername(fd, (struct sockaddr *)&ss, &len);
+    for (int i = 0; ret == 0 && i < nfilters && !mitigated; i++) {
+      mitigated = filter_match(&filters[i], &ss);
+    }
+  }
+  int state = mitigated ? FD_MITIGATED : FD_PLAIN;
+  atomic_store_explicit(&fd_states[fd], state, memory_order_relaxed);
+  return state;
+}
+
+// The fast path every intercepted call takes
+static inline int fd_selected(int fd) {
+  pthread_once(&setup_once, preload_setup);
+  if (!selecting || fd < 0 || fd >= PRELOAD_MAX_FDS)
+    return 0;
+  int state = atomic_load_explicit(&fd_states[fd], memory_order_relaxed);
+  if (state == FD_UNKNOWN)
+    state = fd_classify(fd);
+  return state == FD_MITIGATED;
+}
+
+static ssize_t held_perform(const struct held_call *c) {
+  switch (c->op) {
+  case HELD_WRITE:
+    return real_write(c->fd, c->buf, c->len);
+  case HELD_SEND:
+    return real_send(c->fd, c->buf, c->len, c->flags);
+  case HELD_SENDMSG:
+    return real_sendmsg(c->fd, c->msg, c->flags);
+  default:
+    return real_writev(c->fd, c->iov, c->iovcnt);
+  }
+}
+
+// Release callback, on the release thread at the call's slot: wakes the
+// caller and nothing more, so it never blocks on the descriptor
+static void held_release(const struct mitigate_output *out) {
+  struct held_call *c = out->ctx;
+  pthread_mutex_lock(&c->lock);
+  c->done = 1;
+  pthread_cond_signal(&c->released);
+  pthread_mutex_unlock(&c->lock); // c may be gone from here on
+}
+
+// The channel of a selected descriptor, with its lock held. NULL if the
+// engine couldn't be started.
+static struct fd_channel *fd_channel_lock(int fd) {
+  pthread_mutex_lock(&table_lock);
+  if (engine == NULL)
+    engine = mitigate_create(&engine_cfg);
+  struct fd_channel *fc = fd_channels[fd];
+  if (engine != NULL && fc == NULL) {
+    fc = calloc(1, sizeof(*fc));
+    if (fc != NULL) {
+      pthread_mutex_init(&fc->lock, NULL);
+      pthread_cond_init(&fc->idle, NULL);
+      fd_channels[fd] = fc;
+    }
+  }
+  pthread_mutex_unlock(&table_lock);
+  if (engine == NULL || fc == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&fc->lock);
+  if (fc->ch == NULL)
+    fc->ch = mitigate_channel_create(engine, NULL);
+  if (fc->ch == NULL) {
+    pthread_mutex_unlock(&fc->lock);
+    return NULL;
+  }
+  return fc;
+}
+
+// Queues the call on its descriptor's channel, waits for its slot and makes
+// it. Falls back to making it at once if the engine can't take it.
+static ssize_t held_submit(struct held_call *c) {
+  struct fd_channel *fc = fd_channel_lock(c->fd);
+  if (fc == NULL)
+    return held_perform(c);
+
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->released, NULL);
+  c->done = 0;
+  struct mitigate_output out = {.release = held_release, .ctx = c};
+  mitigate_submit_output(fc->ch, &out);
+  fc->inflight++;
+  pthread_mutex_unlock(&fc->lock);
+
+  pthread_mutex_lock(&c->lock);
+  while (!c->done) {
+    pthread_cond_wait(&c->released, &c->lock);
+  }
+  pthread_mutex_unlock(&c->lock);
+  pthread_cond_destroy(&c->released);
+  pthread_mutex_destroy(&c->lock);
+
+  ssize_t result = held_perform(c);
+  int error = errno;
+  pthread_mutex_lock(&fc->lock);
+  if (--fc->inflight == 0)
+    pthread_cond_broadcast(&fc->idle);
+  pthread_mutex_unlock(&fc->lock);
+  errno = error;
+  return result;
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  if (!fd_selected(fd))
+    return real_write(fd, buf, count);
+  struct held_call c = {.op = HELD_WRITE, .fd = fd, .buf = buf, .len = count};
+  return held_submit(&c);
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+  if (!fd_selected(fd))
+    return real_send(fd, buf, len, flags);
+  struct held_call c = {
+      .op = HELD_SEND, .fd = fd, .buf = buf, .len = len, .flags = flags};
+  return held_submit(&c);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+  if (!fd_selected(fd))
+    return real_sendmsg(fd, msg, flags);
+  struct held_call c = {
+      .op = HELD_SENDMSG, .fd = fd, .msg = msg, .flags = flags};
+  return held_submit(&c);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+  if (!fd_selected(fd))
+    return real_writev(fd, iov, iovcnt);
+  struct held_call c = {
+      .op = HELD_WRITEV, .fd = fd, .iov = iov, .iovcnt = iovcnt};
+  return held_submit(&c);
+}
+
+int close(int fd) {
+  pthread_once(&setup_once, preload_setup);
+  if (selecting && fd >= 0 && fd < PRELOAD_MAX_FDS &&
+      atomic_exchange_explicit(&fd_states[fd], FD_UNKNOWN,
+                               memory_order_relaxed) == FD_MITIGATED) {
+    pthread_mutex_lock(&table_lock);
+    struct fd_channel *fc = fd_channels[fd];
+    pthread_mutex_unlock(&table_lock);
+    if (fc != NULL) {
+      // Anything another thread still has queued leaves on its own slot, and
+      // is written, before the descriptor goes: destroying the channel would
+      // release it at once, unmitigated. The wait gives up fc->lock.
+      pthread_mutex_lock(&fc->lock);
+      while (fc->inflight > 0) {
+        pthread_cond_wait(&fc->idle, &fc->lock);
+      }
+      mitigate_channel_t *ch = fc->ch;
+      fc->ch = NULL;
+      pthread_mutex_unlock(&fc->lock);
+      if (ch != NULL)
+        mitigate_channel_destroy(ch);
+    }
+  }
+  return real_close(fd);
+}
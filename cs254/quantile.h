@@ -0,0 +1,95 @@
+#ifndef QUANTILE_H
+#define QUANTILE_H
+
+// Streaming percentile estimate with the P-squared algorithm (Jain and
+// Chlamtac, 1985): five markers whose heights follow the minimum, p/2, p,
+// (1+p)/2 quantiles and the maximum, adjusted by piecewise-parabolic
+// interpolation as samples arrive. Constant memory and O(1) per sample.
+
+struct p2_sketch {
+  double p;
+  unsigned long long count;
+  double height[5];
+  double pos[5];     // actual marker positions, 1-based
+  double desired[5]; // where they should be
+  double step[5];    // how far desired moves per sample
+};
+
+static inline void p2_init(struct p2_sketch *s, double p) {
+  s->p = p;
+  s->count = 0;
+  double desired[5] = {1, 1 + 2 * p, 1 + 4 * p, 3 + 2 * p, 5};
+  double step[5] = {0, p / 2, p, (1 + p) / 2, 1};
+  for (int i = 0; i < 5; i++) {
+    s->pos[i] = i + 1;
+    s->desired[i] = desired[i];
+    s->step[i] = step[i];
+  }
+}
+
+static inline double p2_parabolic(const struct p2_sketch *s, int i, double d) {
+  const double *q = s->height, *n = s->pos;
+  return q[i] + d / (n[i + 1] - n[i - 1]) *
+                    ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) /
+                         (n[i + 1] - n[i]) +
+                     (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) /
+                         (n[i] - n[i - 1]));
+}
+
+static inline void p2_add(struct p2_sketch *s, double x) {
+  double *q = s->height, *n = s->pos;
+  if (s->count < 5) {
+    // Keep the first five sorted; they become the markers
+    int i = s->count++;
+    for (; i > 0 && q[i - 1] > x; i--) {
+      q[i] = q[i - 1];
+    }
+    q[i] = x;
+    return;
+  }
+  s->count++;
+
+  int k;
+  if (x < q[0]) {
+    q[0] = x;
+    k = 0;
+  } else if (x >= q[4]) {
+    q[4] = x;
+    k = 3;
+  } else {
+    for (k = 0; x >= q[k + 1]; k++) {
+    }
+  }
+  for (int i = k + 1; i < 5; i++) {
+    n[i]++;
+  }
+  for (int i = 0; i < 5; i++) {
+    s->desired[i] += s->step[i];
+  }
+
+  for (int i = 1; i < 4; i++) {
+    double d = s->desired[i] - n[i];
+    if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+      d = d > 0 ? 1 : -1;
+      double h = p2_parabolic(s, i, d);
+      if (!(q[i - 1] < h && h < q[i + 1])) {
+        int j = i + (int)d;
+        h = q[i] + d * (q[j] - q[i]) / (n[j] - n[i]);
+      }
+      q[i] = h;
+      n[i] += d;
+    }
+  }
+}
+
+// The current estimate, exact while there are five samples or fewer; 0
+// before the first
+static inline double p2_value(const struct p2_sketch *s) {
+  if (s->count == 0)
+    return 0;
+  if (s->count <= 5)
+    return s->height[(int)(s->p * (s->count - 1) + 0.5)];
+  return s->height[2];
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef RELEASE_TIMER_H
+#define RELEASE_TIMER_H
+
+#include <time.h>
+
+// Absolute-deadline timer for the release thread. Every deadline is the
+// previous *scheduled* deadline plus the current quantum, so time spent
+// printing or waking up late never pushes the following releases back.
+
+#define NSEC_PER_SEC 1000000000LL
+
+struct release_timer {
+  long long start_ns;    // when release_timer_start was called
+  long long deadline_ns; // the slot the thread is currently released for
+  long long actual_ns;   // when the thread actually woke up for that slot
+};
+
+static inline long long release_timer_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// The first slot is "now"
+static inline void release_timer_start(struct release_timer *t) {
+  t->start_ns = release_timer_now_ns();
+  t->deadline_ns = t->start_ns;
+  t->actual_ns = t->start_ns;
+}
+
+static inline struct timespec release_timer_timespec(long long ns) {
+  struct timespec ts = {
+      .tv_sec = ns / NSEC_PER_SEC,
+      .tv_nsec = ns % NSEC_PER_SEC,
+  };
+  return ts;
+}
+
+// Moves on to the slot q_ns after the previous scheduled deadline, without
+// sleeping: callers wait on the deadline themselves
+static inline long long release_timer_advance(struct release_timer *t,
+                                              long long q_ns) {
+  t->deadline_ns += q_ns;
+  return t->deadline_ns;
+}
+
+// How late the current slot was served, in nanoseconds
+static inline long long
+release_timer_lateness_ns(const struct release_timer *t) {
+  return t->actual_ns - t->deadline_ns;
+}
+
+#endif
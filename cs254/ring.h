@@ -0,0 +1,236 @@
+#ifndef RING_H
+#define RING_H
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#ifdef RING_MUTEX
+#include <pthread.h>
+#endif
+
+#include "mitigate_output.h"
+
+// Fixed-capacity release queue shared by the mitigators. The capacity is
+// rounded up to a power of two so head and tail wrap with a mask, and push/pop
+// are O(1) instead of shifting every pending output down by one.
+//
+// By default the ring is a lock-free single-producer/single-consumer queue:
+// the mitigator is the only pusher and q_interval the only popper, so the two
+// sides only meet through acquire/release loads and stores of head and tail.
+// Building with -DRING_MUTEX (make QUEUE=mutex) swaps in a mutex-protected
+// ring with the same interface.
+//
+// Slots hold output descriptors by value; the payload bytes they point to
+// stay where the producer put them.
+
+#define RING_CACHE_LINE 64
+
+// What ring_push does when every slot is already taken
+enum ring_overflow {
+  RING_DROP_OLDEST, // discard the oldest pending output (RING_MUTEX only)
+  RING_REJECT,      // leave the queue untouched and report the failure
+  RING_BLOCK,       // yield until the consumer frees a slot
+};
+
+struct ring {
+  // Consumer side: head plus the last tail value the consumer saw
+  _Alignas(RING_CACHE_LINE) atomic_uint head;
+  unsigned int tail_cache;
+
+  // Producer side: tail plus the last head value the producer saw
+  _Alignas(RING_CACHE_LINE) atomic_uint tail;
+  unsigned int head_cache;
+
+  // Read-only after ring_init
+  _Alignas(RING_CACHE_LINE) struct mitigate_output *slots;
+  unsigned int mask;
+  enum ring_overflow overflow;
+#ifdef RING_MUTEX
+  pthread_mutex_t lock;
+#endif
+};
+
+// Largest capacity a ring can have: one more doubling wraps to 0
+#define RING_MAX_CAPACITY (1u << 31)
+
+// The smallest power of two >= n, or 0 if that is above RING_MAX_CAPACITY
+static inline unsigned int ring_round_up(unsigned int n) {
+  if (n > RING_MAX_CAPACITY)
+    return 0;
+  unsigned int capacity = 1;
+  while (capacity < n) {
+    capacity <<= 1;
+  }
+  return capacity;
+}
+
+// Returns 0 on success, -1 if the capacity is too large, the slots could not
+// be allocated or the overflow policy needs the mutex ring
+static inline int ring_init(struct ring *r, unsigned int min_capacity,
+                            enum ring_overflow overflow) {
+#ifndef RING_MUTEX
+  // Dropping the oldest output means the producer moving head, which would
+  // make it a second consumer
+  if (overflow == RING_DROP_OLDEST)
+    return -1;
+#endif
+  unsigned int capacity = ring_round_up(min_capacity);
+  if (capacity == 0)
+    return -1;
+  r->slots = malloc((size_t)capacity * sizeof(*r->slots));
+  if (r->slots == NULL)
+    return -1;
+  r->mask = capacity - 1;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  r->tail_cache = 0;
+  r->head_cache = 0;
+  r->overflow = overflow;
+#ifdef RING_MUTEX
+  if (pthread_mutex_init(&r->lock, NULL) != 0) {
+    free(r->slots);
+    r->slots = NULL;
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+static inline void ring_destroy(struct ring *r) {
+#ifdef RING_MUTEX
+  pthread_mutex_destroy(&r->lock);
+#endif
+  free(r->slots);
+  r->slots = NULL;
+}
+
+static inline unsigned int ring_capacity(const struct ring *r) {
+  return r->mask + 1;
+}
+
+// head and tail are free-running, so unsigned wraparound keeps this correct.
+// Exact from either side of the lock-free ring only as a snapshot.
+static inline unsigned int ring_size(struct ring *r) {
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_acquire);
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  return tail - head;
+}
+
+#ifdef RING_MUTEX
+
+// Returns 0 if the value was queued, 1 if it was queued by dropping the oldest
+// output and -1 if it was rejected
+static inline int ring_push(struct ring *r,
+                            const struct mitigate_output *value) {
+  int dropped = 0;
+  pthread_mutex_lock(&r->lock);
+  while (ring_size(r) == ring_capacity(r)) {
+    if (r->overflow == RING_REJECT) {
+      pthread_mutex_unlock(&r->lock);
+      return -1;
+    }
+    if (r->overflow == RING_DROP_OLDEST) {
+      atomic_fetch_add_explicit(&r->head, 1, memory_order_relaxed);
+      dropped = 1;
+      break;
+    }
+    pthread_mutex_unlock(&r->lock);
+    sched_yield();
+    pthread_mutex_lock(&r->lock);
+  }
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  r->slots[tail & r->mask] = *value;
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_relaxed);
+  pthread_mutex_unlock(&r->lock);
+  return dropped;
+}
+
+// Returns 0 and stores the oldest output in *value, or -1 if the queue is empty
+static inline int ring_pop(struct ring *r, struct mitigate_output *value) {
+  pthread_mutex_lock(&r->lock);
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&r->tail, memory_order_relaxed)) {
+    pthread_mutex_unlock(&r->lock);
+    return -1;
+  }
+  *value = r->slots[head & r->mask];
+  atomic_store_explicit(&r->head, head + 1, memory_order_relaxed);
+  pthread_mutex_unlock(&r->lock);
+  return 0;
+}
+
+// Pops up to max of the oldest outputs into values under one lock
+// acquisition. Returns how many were popped.
+static inline unsigned int ring_pop_batch(struct ring *r,
+                                          struct mitigate_output *values,
+                                          unsigned int max) {
+  pthread_mutex_lock(&r->lock);
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned int n = atomic_load_explicit(&r->tail, memory_order_relaxed) - head;
+  if (n > max)
+    n = max;
+  for (unsigned int i = 0; i < n; i++) {
+    values[i] = r->slots[(head + i) & r->mask];
+  }
+  atomic_store_explicit(&r->head, head + n, memory_order_relaxed);
+  pthread_mutex_unlock(&r->lock);
+  return n;
+}
+
+#else
+
+// Producer only. Returns 0 if the value was queued and -1 if it was rejected.
+static inline int ring_push(struct ring *r,
+                            const struct mitigate_output *value) {
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  while (tail - r->head_cache == ring_capacity(r)) {
+    // Only go back to the shared head once the cached one says we're full
+    r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - r->head_cache < ring_capacity(r))
+      break;
+    if (r->overflow == RING_REJECT)
+      return -1;
+    sched_yield();
+  }
+  r->slots[tail & r->mask] = *value;
+  // Publishes the slot write to the consumer
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+// Consumer only. Returns 0 and stores the oldest output in *value, or -1 if
+// the queue is empty.
+static inline int ring_pop(struct ring *r, struct mitigate_output *value) {
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head == r->tail_cache) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head == r->tail_cache)
+      return -1;
+  }
+  *value = r->slots[head & r->mask];
+  // Hands the slot back to the producer only after it has been read
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return 0;
+}
+
+// Consumer only. Pops up to max of the oldest outputs into values with one
+// acquire of tail and one release of head. Returns how many were popped.
+static inline unsigned int ring_pop_batch(struct ring *r,
+                                          struct mitigate_output *values,
+                                          unsigned int max) {
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+  unsigned int n = r->tail_cache - head;
+  if (n > max)
+    n = max;
+  for (unsigned int i = 0; i < n; i++) {
+    values[i] = r->slots[(head + i) & r->mask];
+  }
+  if (n > 0)
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+  return n;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE // sched_setaffinity
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "release_timer.h"
+#include "sandbox.h"
+
+#define SANDBOX_SLOTS 64          // secrets in flight per worker
+#define SANDBOX_SPIN_NS 50000     // busy-wait this long before sleeping...
+#define SANDBOX_CHECK_NS 1000000  // how often a waiting caller checks health
+
+// A secret going out, then its output coming back in the same slot
+struct sandbox_slot {
+  int (*target_function)(int);
+  unsigned long long secret;
+  int output;
+  long long ns; // evaluation time, -1 if the worker died on it
+};
+
+// One worker's ring. The caller writes submitted and collected, the worker
+// done and started_ns; each side sleeps on the other's counter.
+struct sandbox_lane {
+  _Alignas(64) atomic_uint submitted;
+  atomic_int caller_waiting;
+  unsigned int collected;
+  _Alignas(64) atomic_uint done;
+  atomic_int worker_waiting;
+  atomic_llong started_ns; // when the current secret started, 0 when idle
+  struct sandbox_slot slots[SANDBOX_SLOTS];
+};
+
+struct sandbox_shared {
+  atomic_int shutdown;
+  long long spin_ns; // ...unless there is only one core to spin on
+  struct sandbox_lane lanes[];
+};
+
+// Workers are forked by a zygote, a process sandbox_create forks while the
+// caller is still single-threaded. Forking them from the caller once its
+// pool, logger and release threads run would hand each worker whatever
+// locks those threads held at the time, and the target's first malloc or
+// printf could then deadlock. The caller asks for a worker by sending a
+// lane index down zygote_sock and gets back a pidfd for it.
+struct sandbox {
+  struct sandbox_shared *shm; // MAP_SHARED, inherited by every worker
+  size_t bytes;
+  pid_t zygote;
+  int zygote_sock;
+  int *pidfds; // one per worker, readable once it has exited
+  int nworkers;
+  long long timeout_ns;
+  int ncpus;
+  atomic_ullong restarts;
+};
+
+static void futex_wait(atomic_uint *word, unsigned int seen, long long ns) {
+  struct timespec ts = release_timer_timespec(ns);
+  syscall(SYS_futex, word, FUTEX_WAIT, seen, ns > 0 ? &ts : NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+// Waits for *word to move on from seen: spins for spin_ns, then announces
+// itself in *waiting and sleeps for at most sleep_ns (0 for as long as it
+// takes). Returns the new value, or seen on timeout.
+static unsigned int lane_wait(atomic_uint *word, atomic_int *waiting,
+                              unsigned int seen, long long spin_ns,
+                              long long sleep_ns) {
+  long long spin_until = release_timer_now_ns() + spin_ns;
+  unsigned int now;
+  while ((now = atomic_load_explicit(word, memory_order_acquire)) == seen) {
+    if (release_timer_now_ns() >= spin_until) {
+      atomic_store(waiting, 1);
+      atomic_thread_fence(memory_order_seq_cst);
+      if (atomic_load_explicit(word, memory_order_acquire) == seen)
+        futex_wait(word, seen, sleep_ns);
+      atomic_store(waiting, 0);
+      return atomic_load_explicit(word, memory_order_acquire);
+    }
+    cpu_relax();
+  }
+  return now;
+}
+
+// Publishes a counter bump and wakes the other side if it went to sleep
+static void lane_signal(atomic_uint *word, atomic_int *waiting) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(waiting, memory_order_relaxed))
+    futex_wake(word);
+}
+
+static _Noreturn void worker_main(struct sandbox_shared *shm,
+                                  struct sandbox_lane *lane) {
+  unsigned int done = atomic_load_explicit(&lane->done, memory_order_relaxed);
+  while (!atomic_load_explicit(&shm->shutdown, memory_order_relaxed)) {
+    unsigned int submitted =
+        atomic_load_explicit(&lane->submitted, memory_order_acquire);
+    if (submitted == done) {
+      lane_wait(&lane->submitted, &lane->worker_waiting, done, shm->spin_ns,
+                0);
+      continue;
+    }
+    struct sandbox_slot *slot = &lane->slots[done % SANDBOX_SLOTS];
+    long long start = release_timer_now_ns();
+    atomic_store_explicit(&lane->started_ns, start, memory_order_relaxed);
+    slot->output = slot->target_function(slot->secret);
+    slot->ns = release_timer_now_ns() - start;
+    atomic_store_explicit(&lane->started_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&lane->done, ++done, memory_order_release);
+    lane_signal(&lane->done, &lane->caller_waiting);
+  }
+  _exit(0);
+}
+
+// In the zygote: forks the worker for lane w, pinned to a core of its own.
+// The first core is left to the mitigator's threads when there is more than
+// one. Returns a pidfd for the worker, or -1.
+static int worker_fork(struct sandbox *sb, int w) {
+  pid_t parent = getpid();
+  pid_t pid = fork();
+  if (pid < 0)
+    return -1;
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent)
+      _exit(0);
+    close(sb->zygote_sock);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(sb->ncpus > 1 ? 1 + w % (sb->ncpus - 1) : 0, &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+    worker_main(sb->shm, &sb->shm->lanes[w]);
+  }
+  // Not reaped before this, so pid is still the worker's
+  int pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (pidfd < 0)
+    kill(pid, SIGKILL);
+  return pidfd;
+}
+
+// The zygote's loop: one worker per lane index received, its pidfd sent
+// back, until the caller closes its end. Workers that have died since the
+// last request are reaped first; the rest when the zygote exits.
+static _Noreturn void zygote_main(struct sandbox *sb) {
+  int w;
+  while (recv(sb->zygote_sock, &w, sizeof(w), 0) == sizeof(w)) {
+    while (waitpid(-1, NULL, WNOHANG) > 0) {
+    }
+    int pidfd = worker_fork(sb, w);
+    int ok = pidfd >= 0;
+    struct iovec iov = {.iov_base = &ok, .iov_len = sizeof(ok)};
+    union {
+      char buf[CMSG_SPACE(sizeof(int))];
+      struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (ok) {
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &pidfd, sizeof(int));
+    }
+    sendmsg(sb->zygote_sock, &msg, MSG_NOSIGNAL);
+    if (ok)
+      close(pidfd);
+  }
+  while (wait(NULL) > 0) {
+  }
+  _exit(0);
+}
+
+// Forks the zygote, which takes one end of a fresh socket pair
+static int zygote_start(struct sandbox *sb) {
+  int socks[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) != 0)
+    return -1;
+  pid_t parent = getpid();
+  sb->zygote = fork();
+  if (sb->zygote < 0) {
+    close(socks[0]);
+    close(socks[1]);
+    return -1;
+  }
+  if (sb->zygote == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent)
+      _exit(0);
+    close(socks[0]);
+    sb->zygote_sock = socks[1];
+    zygote_main(sb);
+  }
+  close(socks[1]);
+  sb->zygote_sock = socks[0];
+  return 0;
+}
+
+// Has the zygote start the worker for lane w
+static int worker_start(struct sandbox *sb, int w) {
+  if (send(sb->zygote_sock, &w, sizeof(w), MSG_NOSIGNAL) != sizeof(w))
+    return -1;
+  int ok = 0;
+  struct iovec iov = {.iov_base = &ok, .iov_len = sizeof(ok)};
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control.buf,
+                       .msg_controllen = sizeof(control.buf)};
+  if (recvmsg(sb->zygote_sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(ok) || !ok)
+    return -1;
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+    return -1;
+  memcpy(&sb->pidfds[w], CMSG_DATA(cmsg), sizeof(int));
+  return 0;
+}
+
+static void worker_kill(struct sandbox *sb, int w) {
+  syscall(SYS_pidfd_send_signal, sb->pidfds[w], SIGKILL, NULL, 0);
+}
+
+// Replaces a worker that died or hung. The secret it had in hand gets
+// SANDBOX_FAILED and the new worker carries on with the next one.
+static int worker_restart(struct sandbox *sb, int w) {
+  struct sandbox_lane *lane = &sb->shm->lanes[w];
+  unsigned int done = atomic_load_explicit(&lane->done, memory_order_relaxed);
+  if (done != atomic_load_explicit(&lane->submitted, memory_order_relaxed)) {
+    lane->slots[done % SANDBOX_SLOTS].output = SANDBOX_FAILED;
+    lane->slots[done % SANDBOX_SLOTS].ns = -1;
+    atomic_store_explicit(&lane->done, done + 1, memory_order_release);
+  }
+  atomic_store(&lane->started_ns, 0);
+  atomic_store(&lane->worker_waiting, 0);
+  atomic_fetch_add(&sb->restarts, 1);
+  close(sb->pidfds[w]);
+  sb->pidfds[w] = -1;
+  return worker_start(sb, w);
+}
+
+// Checks on the worker the caller is waiting for. Returns 1 if it had to be
+// replaced, 0 if it is fine and -1 if it couldn't be replaced.
+static int worker_check(struct sandbox *sb, int w) {
+  struct sandbox_lane *lane = &sb->shm->lanes[w];
+  struct pollfd exited = {.fd = sb->pidfds[w], .events = POLLIN};
+  int ret = exited.fd >= 0 ? poll(&exited, 1, 0) : 1; // -1: never replaced
+  if (ret == 0) {
+    long long started =
+        atomic_load_explicit(&lane->started_ns, memory_order_relaxed);
+    if (sb->timeout_ns <= 0 || started == 0 ||
+        release_timer_now_ns() - started < sb->timeout_ns)
+      return 0;
+    worker_kill(sb, w);
+    while (poll(&exited, 1, -1) < 0 && errno == EINTR) {
+    }
+  } else if (ret < 0) {
+    return 0;
+  }
+  return worker_restart(sb, w) == 0 ? 1 : -1;
+}
+
+struct sandbox *sandbox_create(int nworkers, long long timeout_ns) {
+  struct sandbox *sb = calloc(1, sizeof(*sb));
+  if (sb == NULL)
+    return NULL;
+  sb->nworkers = nworkers;
+  sb->timeout_ns = timeout_ns;
+  sb->ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  sb->bytes = sizeof(struct sandbox_shared) +
+              nworkers * sizeof(struct sandbox_lane);
+  sb->pidfds = calloc(nworkers, sizeof(*sb->pidfds));
+  sb->shm = mmap(NULL, sb->bytes, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (sb->pidfds == NULL || sb->shm == MAP_FAILED) {
+    if (sb->shm != MAP_FAILED)
+      munmap(sb->shm, sb->bytes);
+    free(sb->pidfds);
+    free(sb);
+    return NULL;
+  }
+  sb->shm->spin_ns = sb->ncpus > 1 ? SANDBOX_SPIN_NS : 0;
+  if (zygote_start(sb) != 0) {
+    munmap(sb->shm, sb->bytes);
+    free(sb->pidfds);
+    free(sb);
+    return NULL;
+  }
+  for (int w = 0; w < nworkers; w++) {
+    if (worker_start(sb, w) != 0) {
+      sb->nworkers = w;
+      sandbox_destroy(sb);
+      return NULL;
+    }
+  }
+  return sb;
+}
+
+void sandbox_destroy(struct sandbox *sb) {
+  atomic_store(&sb->shm->shutdown, 1);
+  for (int w = 0; w < sb->nworkers; w++) {
+    if (sb->pidfds[w] >= 0) {
+      worker_kill(sb, w);
+      close(sb->pidfds[w]);
+    }
+  }
+  // The zygote reaps every worker before it exits
+  close(sb->zygote_sock);
+  waitpid(sb->zygote, NULL, 0);
+  munmap(sb->shm, sb->bytes);
+  free(sb->pidfds);
+  free(sb);
+}
+
+unsigned long long sandbox_restarts(const struct sandbox *sb) {
+  return atomic_load(&sb->restarts);
+}
+
+int sandbox_map_ordered(struct sandbox *sb, int (*target_function)(int),
+                        unsigned long long secrets[], int secrets_size,
+                        void (*emit)(int output, long long ns, void *ctx),
+                        void *ctx) {
+  int dispatched = 0;
+  for (int emitted = 0; emitted < secrets_size; emitted++) {
+    // Keep every worker's ring as full as the batch allows
+    for (; dispatched < secrets_size; dispatched++) {
+      struct sandbox_lane *lane = &sb->shm->lanes[dispatched % sb->nworkers];
+      unsigned int submitted =
+          atomic_load_explicit(&lane->submitted, memory_order_relaxed);
+      if (submitted - lane->collected == SANDBOX_SLOTS)
+        break;
+      struct sandbox_slot *slot = &lane->slots[submitted % SANDBOX_SLOTS];
+      slot->target_function = target_function;
+      slot->secret = secrets[dispatched];
+      atomic_store_explicit(&lane->submitted, submitted + 1,
+                            memory_order_release);
+      lane_signal(&lane->submitted, &lane->worker_waiting);
+    }
+
+    int w = emitted % sb->nworkers;
+    struct sandbox_lane *lane = &sb->shm->lanes[w];
+    while (atomic_load_explicit(&lane->done, memory_order_acquire) ==
+           lane->collected) {
+      if (lane_wait(&lane->done, &lane->caller_waiting, lane->collected,
+                    sb->shm->spin_ns, SANDBOX_CHECK_NS) == lane->collected &&
+          worker_check(sb, w) < 0)
+        return -1;
+    }
+    struct sandbox_slot *slot = &lane->slots[lane->collected % SANDBOX_SLOTS];
+    int output = slot->output;
+    long long ns = slot->ns;
+    lane->collected++;
+    emit(output, ns, ctx);
+  }
+  return 0;
+}
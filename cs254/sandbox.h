@@ -0,0 +1,44 @@
+#ifndef SANDBOX_H
+#define SANDBOX_H
+
+#include "mitigate.h"
+
+// Process isolation for target_function: a pool of pre-forked worker
+// processes, each pinned to its own core, fed through a ring in shared
+// memory. A target that crashes or hangs takes down only its worker, which
+// is replaced, and its cache and allocator traffic stays off the release
+// thread's core and out of its heap.
+//
+// Same contract as pool_map_ordered. Secret i goes to worker i % nworkers,
+// so each worker's ring returns results in index order and the caller's
+// reorder stage is just round-robin. Both sides spin briefly before sleeping
+// on a futex, so a busy batch is dispatched without syscalls.
+
+// Output emitted for a secret whose target crashed or was killed as hung
+#define SANDBOX_FAILED MITIGATE_TARGET_FAILED
+
+struct sandbox;
+
+// Forks nworkers (> 0) workers, by way of a zygote process forked first, so
+// call it before the caller starts any threads. A target still running
+// after timeout_ns is killed (0 never). Workers, replacements included,
+// share the caller's address space layout as of this call, so targets must
+// be linked in, not loaded later. Returns NULL on failure.
+struct sandbox *sandbox_create(int nworkers, long long timeout_ns);
+
+// Kills the workers. No batch may be running.
+void sandbox_destroy(struct sandbox *sb);
+
+// Workers replaced after a crash or hang so far
+unsigned long long sandbox_restarts(const struct sandbox *sb);
+
+// Evaluates target_function(secrets[i]) in the workers and calls
+// emit(output, ns, ctx) on the calling thread in index order, ns being how
+// long the evaluation took, or -1 if it failed. One batch at a time.
+// Returns 0, or -1 if a worker could not be replaced.
+int sandbox_map_ordered(struct sandbox *sb, int (*target_function)(int),
+                        unsigned long long secrets[], int secrets_size,
+                        void (*emit)(int output, long long ns, void *ctx),
+                        void *ctx);
+
+#endif
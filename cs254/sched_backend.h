@@ -0,0 +1,86 @@
+#ifndef SCHED_BACKEND_H
+#define SCHED_BACKEND_H
+
+#include <limits.h>
+
+#include "heap.h"
+#include "wheel.h"
+
+// Release schedule of a mitigator: which channel is due next. Either a
+// deadline heap (exact, O(log N)) or a timer wheel (O(1), tick-granular),
+// chosen when the mitigator is created.
+
+enum sched_backend {
+  SCHED_HEAP,
+  SCHED_WHEEL,
+};
+
+struct sched {
+  enum sched_backend backend;
+  union {
+    struct heap heap;
+    struct wheel wheel;
+  };
+};
+
+// Returns 0, or -1 if the heap could not be allocated or the wheel was
+// given a tick_ns <= 0
+static inline int sched_init(struct sched *s, enum sched_backend backend,
+                             long long tick_ns, long long now) {
+  s->backend = backend;
+  if (backend == SCHED_WHEEL) {
+    if (tick_ns <= 0)
+      return -1;
+    wheel_init(&s->wheel, tick_ns, now);
+    return 0;
+  }
+  return heap_init(&s->heap, 16);
+}
+
+static inline void sched_destroy(struct sched *s) {
+  if (s->backend == SCHED_HEAP)
+    heap_destroy(&s->heap);
+}
+
+static inline int sched_insert(struct sched *s, struct sched_entry *e) {
+  if (s->backend == SCHED_WHEEL) {
+    wheel_insert(&s->wheel, e);
+    return 0;
+  }
+  return heap_push(&s->heap, e);
+}
+
+static inline void sched_remove(struct sched *s, struct sched_entry *e) {
+  if (s->backend == SCHED_WHEEL)
+    wheel_remove(&s->wheel, e);
+  else
+    heap_remove(&s->heap, e);
+}
+
+// An entry whose deadline has passed, or NULL. The entry stays scheduled;
+// move its deadline on and call sched_reschedule.
+static inline struct sched_entry *sched_due(struct sched *s, long long now) {
+  if (s->backend == SCHED_WHEEL)
+    return wheel_due(&s->wheel, now);
+  struct sched_entry *e = heap_min(&s->heap);
+  return e != NULL && e->deadline <= now ? e : NULL;
+}
+
+static inline void sched_reschedule(struct sched *s, struct sched_entry *e) {
+  if (s->backend == SCHED_WHEEL) {
+    wheel_remove(&s->wheel, e);
+    wheel_insert(&s->wheel, e);
+  } else {
+    heap_update(&s->heap, e);
+  }
+}
+
+// When to look at sched_due again; LLONG_MAX if nothing is scheduled
+static inline long long sched_next_wakeup(const struct sched *s) {
+  if (s->backend == SCHED_WHEEL)
+    return wheel_next_wakeup(&s->wheel);
+  struct sched_entry *e = heap_min(&s->heap);
+  return e != NULL ? e->deadline : LLONG_MAX;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <sys/mman.h>
+
+#include "slab.h"
+
+// Anonymous private mapping with every page faulted in before returning
+static char *slab_map(size_t bytes) {
+  void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  return base == MAP_FAILED ? NULL : base;
+}
+
+int slab_init(struct slab *s, size_t obj_size, unsigned int count) {
+  if (obj_size < sizeof(struct slab_obj))
+    obj_size = sizeof(struct slab_obj);
+  s->obj_size = (obj_size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+  s->count = count;
+  s->bytes = s->obj_size * count;
+  s->base = s->bytes > 0 ? slab_map(s->bytes) : NULL;
+  if (s->bytes > 0 && s->base == NULL)
+    return -1;
+
+  // Thread the free list in address order
+  s->local = NULL;
+  for (unsigned int i = count; i > 0; i--) {
+    struct slab_obj *obj = (void *)(s->base + (i - 1) * s->obj_size);
+    obj->next = s->local;
+    s->local = obj;
+  }
+  atomic_init(&s->returned, NULL);
+  return 0;
+}
+
+void slab_destroy(struct slab *s) {
+  if (s->base != NULL)
+    munmap(s->base, s->bytes);
+  s->base = NULL;
+  s->local = NULL;
+}
+
+int arena_init(struct arena *a, size_t bytes) {
+  a->base = NULL;
+  a->bytes = 0;
+  a->used = 0;
+  return arena_reserve(a, bytes);
+}
+
+void arena_destroy(struct arena *a) {
+  if (a->base != NULL)
+    munmap(a->base, a->bytes);
+  a->base = NULL;
+  a->bytes = 0;
+}
+
+int arena_reserve(struct arena *a, size_t bytes) {
+  if (bytes <= a->bytes)
+    return 0;
+  char *base = slab_map(bytes);
+  if (base == NULL)
+    return -1;
+  arena_destroy(a);
+  a->base = base;
+  a->bytes = bytes;
+  a->used = 0;
+  return 0;
+}
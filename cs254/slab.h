@@ -0,0 +1,90 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Preallocated memory for the hot path, so that neither producing nor
+// releasing an output ever calls malloc or takes a page fault: both would add
+// timing noise that depends on what is being released. The memory is mapped
+// and prefaulted up front, and every operation below is a few loads and
+// stores, whatever the contents.
+
+#define SLAB_ALIGN 64 // objects never share a cache line
+
+struct slab_obj {
+  struct slab_obj *next;
+};
+
+// Fixed-size objects with one owner thread allocating and any thread freeing.
+// The owner pops from its private free list; frees push onto a lock-free
+// return stack, which the owner takes over whole with one exchange once its
+// own list runs dry.
+struct slab {
+  char *base;
+  size_t bytes;
+  size_t obj_size;
+  unsigned int count;
+
+  struct slab_obj *local; // owner only
+
+  _Alignas(SLAB_ALIGN) _Atomic(struct slab_obj *) returned;
+};
+
+// Maps and prefaults count objects of at least obj_size bytes. Returns 0, or
+// -1 if the memory could not be mapped.
+int slab_init(struct slab *s, size_t obj_size, unsigned int count);
+void slab_destroy(struct slab *s);
+
+// Owner only. Returns a free object, or NULL if all of them are in use.
+static inline void *slab_alloc(struct slab *s) {
+  struct slab_obj *obj = s->local;
+  if (obj == NULL) {
+    obj = atomic_exchange_explicit(&s->returned, NULL, memory_order_acquire);
+    if (obj == NULL)
+      return NULL;
+  }
+  s->local = obj->next;
+  return obj;
+}
+
+// Any thread. Gives back an object from slab_alloc.
+static inline void slab_free(struct slab *s, void *ptr) {
+  struct slab_obj *obj = ptr;
+  // Only pushes race here, and a push-only stack has no ABA problem
+  obj->next = atomic_load_explicit(&s->returned, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&s->returned, &obj->next, obj,
+                                                memory_order_release,
+                                                memory_order_relaxed)) {
+  }
+}
+
+// Bump allocator that is emptied all at once, e.g. at the end of a batch.
+// Single thread.
+struct arena {
+  char *base;
+  size_t bytes;
+  size_t used;
+};
+
+// Maps and prefaults bytes of arena. Returns 0, or -1 on failure.
+int arena_init(struct arena *a, size_t bytes);
+void arena_destroy(struct arena *a);
+
+// Makes sure the arena holds at least bytes, remapping it if it is smaller.
+// Only while empty, and off the hot path. Returns 0, or -1 on failure.
+int arena_reserve(struct arena *a, size_t bytes);
+
+// Returns bytes of SLAB_ALIGN-aligned memory, or NULL if the arena is full
+static inline void *arena_alloc(struct arena *a, size_t bytes) {
+  size_t size = (bytes + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+  if (size > a->bytes - a->used)
+    return NULL;
+  void *ptr = a->base + a->used;
+  a->used += size;
+  return ptr;
+}
+
+static inline void arena_reset(struct arena *a) { a->used = 0; }
+
+#endif
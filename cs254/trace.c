@@ -0,0 +1,50 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+struct trace *trace_open(const char *path, unsigned int segment_records,
+                         unsigned int segments) {
+  if (segment_records == 0 || segments == 0)
+    return NULL;
+  struct trace *t = aligned_alloc(64, sizeof(*t));
+  if (t == NULL)
+    return NULL;
+  t->slots = (uint64_t)segment_records * segments;
+  t->bytes = sizeof(struct trace_header) + t->slots * sizeof(*t->records);
+  atomic_init(&t->cursor, 0);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    free(t);
+    return NULL;
+  }
+  // Reserve the blocks now so a full disk shows up here, not as SIGBUS while
+  // releasing
+  void *base = MAP_FAILED;
+  if (posix_fallocate(fd, 0, t->bytes) == 0)
+    base = mmap(NULL, t->bytes, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    free(t);
+    return NULL;
+  }
+
+  t->header = base;
+  t->records = (void *)((char *)base + sizeof(struct trace_header));
+  memcpy(t->header->magic, TRACE_MAGIC, sizeof(t->header->magic));
+  t->header->version = TRACE_VERSION;
+  t->header->record_size = sizeof(struct trace_record);
+  t->header->segment_records = segment_records;
+  t->header->segments = segments;
+  return t;
+}
+
+void trace_close(struct trace *t) {
+  munmap(t->header, t->bytes);
+  free(t);
+}
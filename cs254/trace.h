@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Binary release-event trace. Every submit, release and quantum change is a
+// fixed-size record written straight into a preallocated, memory-mapped
+// file: one fetch_add to claim a slot and a handful of stores, no syscalls
+// and no formatting. trace2csv turns a trace file into CSV.
+//
+// File layout: a trace_header, then `segments` segments of
+// `segment_records` records each. Slot n of the trace is record
+// n % segment_records of segment (n / segment_records) % segments, so once
+// the file is full the oldest segment is the one overwritten next. Records
+// carry their slot number + 1 in seq (0 marks a slot never written), which
+// is how the decoder finds the oldest segment and the end of the trace.
+
+#define TRACE_MAGIC "MTRACE1"
+#define TRACE_VERSION 1
+
+enum trace_kind {
+  TRACE_SUBMIT = 1,  // an output was queued; depth includes it
+  TRACE_RELEASE = 2, // a slot released count outputs; depth still queued
+  TRACE_QUANTUM = 3, // the policy changed q at the end of a slot
+};
+
+struct trace_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t segment_records;
+  uint32_t segments;
+};
+
+struct trace_record {
+  uint64_t seq;
+  int64_t time_ns; // CLOCK_MONOTONIC
+  int64_t q;       // channel quantum at the time, in ns
+  uint32_t channel;
+  uint32_t epoch; // quantum changes on the channel so far
+  uint32_t depth; // outputs queued on the channel
+  uint16_t kind;
+  uint16_t count; // outputs released, TRACE_RELEASE only
+};
+
+struct trace {
+  struct trace_header *header;
+  struct trace_record *records;
+  uint64_t slots; // segment_records * segments
+  uint64_t bytes;
+  _Alignas(64) atomic_ullong cursor;
+};
+
+// Creates or truncates path and maps segments * segment_records records of
+// it, all allocated and faulted in. Returns NULL on failure.
+struct trace *trace_open(const char *path, unsigned int segment_records,
+                         unsigned int segments);
+void trace_close(struct trace *t);
+
+// Any thread
+static inline void trace_emit(struct trace *t, enum trace_kind kind,
+                              long long time_ns, unsigned int channel,
+                              unsigned long long epoch, long long q,
+                              unsigned int depth, unsigned int count) {
+  uint64_t n = atomic_fetch_add_explicit(&t->cursor, 1, memory_order_relaxed);
+  struct trace_record *rec = &t->records[n % t->slots];
+  rec->seq = n + 1;
+  rec->time_ns = time_ns;
+  rec->q = q;
+  rec->channel = channel;
+  rec->epoch = (uint32_t)epoch;
+  rec->depth = depth;
+  rec->kind = kind;
+  rec->count = count > UINT16_MAX ? UINT16_MAX : count;
+}
+
+#endif
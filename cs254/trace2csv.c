@@ -0,0 +1,88 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// Decodes a trace written by libmitigate (see trace.h) into CSV on stdout,
+// oldest record first.
+//
+// Usage: trace2csv TRACE
+
+static const char *kind_name(uint16_t kind) {
+  switch (kind) {
+  case TRACE_SUBMIT:
+    return "submit";
+  case TRACE_RELEASE:
+    return "release";
+  case TRACE_QUANTUM:
+    return "quantum";
+  }
+  return "unknown";
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s TRACE\n", argv[0]);
+    return 2;
+  }
+  int fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  if ((size_t)st.st_size < sizeof(struct trace_header)) {
+    fprintf(stderr, "%s: not a trace\n", argv[1]);
+    return 1;
+  }
+  const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  const struct trace_header *h = (const void *)base;
+  uint64_t slots = (uint64_t)h->segment_records * h->segments;
+  if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != TRACE_VERSION ||
+      h->record_size != sizeof(struct trace_record) ||
+      sizeof(*h) + slots * sizeof(struct trace_record) > (size_t)st.st_size) {
+    fprintf(stderr, "%s: not a version %d trace\n", argv[1], TRACE_VERSION);
+    return 1;
+  }
+  const struct trace_record *records = (const void *)(base + sizeof(*h));
+
+  // Slots are claimed in order, so the segment whose first record has the
+  // lowest seq is the oldest and the rest follow it round the ring
+  unsigned int oldest = 0;
+  for (unsigned int s = 1; s < h->segments; s++) {
+    uint64_t seq = records[(uint64_t)s * h->segment_records].seq;
+    uint64_t best = records[(uint64_t)oldest * h->segment_records].seq;
+    if (seq != 0 && (best == 0 || seq < best))
+      oldest = s;
+  }
+
+  printf("seq,time_ns,kind,channel,epoch,q_ns,depth,count\n");
+  for (unsigned int i = 0; i < h->segments; i++) {
+    unsigned int segment = (oldest + i) % h->segments;
+    uint64_t first = (uint64_t)segment * h->segment_records;
+    for (uint64_t r = first; r < first + h->segment_records; r++) {
+      const struct trace_record *rec = &records[r];
+      // Past the end of the trace, or a stale record from the previous lap
+      // in the segment that was being overwritten
+      if (rec->seq == 0 || rec->seq < records[first].seq)
+        continue;
+      printf("%" PRIu64 ",%" PRId64 ",%s,%" PRIu32 ",%" PRIu32 ",%" PRId64
+             ",%" PRIu32 ",%" PRIu16 "\n",
+             rec->seq - 1, rec->time_ns, kind_name(rec->kind), rec->channel,
+             rec->epoch, rec->q, rec->depth, rec->count);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+#include <limits.h>
+#include <string.h>
+
+#include "wheel.h"
+
+static void list_push(struct sched_entry **head, struct sched_entry *e) {
+  e->prev = NULL;
+  e->next = *head;
+  if (*head != NULL)
+    (*head)->prev = e;
+  *head = e;
+}
+
+// The expired list is FIFO, so a release thread that has fallen behind
+// serves the oldest deadlines first
+static void due_append(struct wheel *w, struct sched_entry *e) {
+  e->slot = WHEEL_DUE;
+  e->next = NULL;
+  e->prev = w->due_tail;
+  if (w->due_tail != NULL)
+    w->due_tail->next = e;
+  else
+    w->due = e;
+  w->due_tail = e;
+}
+
+static void list_unlink(struct sched_entry **head, struct sched_entry *e) {
+  if (e->prev != NULL)
+    e->prev->next = e->next;
+  else
+    *head = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+}
+
+void wheel_init(struct wheel *w, long long tick_ns, long long now) {
+  memset(w, 0, sizeof(*w));
+  w->origin_ns = now;
+  w->tick_ns = tick_ns;
+}
+
+// Files e under the level and slot its tick falls into, relative to now_tick
+static void wheel_place(struct wheel *w, struct sched_entry *e) {
+  long long offset = e->deadline - w->origin_ns;
+  // Round up, so that expiring a tick never releases anything early
+  unsigned long long tick =
+      offset <= 0 ? 0 : (offset + w->tick_ns - 1) / w->tick_ns;
+  if (tick <= w->now_tick) {
+    due_append(w, e);
+    return;
+  }
+
+  unsigned long long delta = tick - w->now_tick;
+  int level = 0;
+  while (level < WHEEL_LEVELS - 1 &&
+         delta >= 1ULL << (WHEEL_BITS * (level + 1))) {
+    level++;
+  }
+  // Beyond the top level's range: park it at the furthest slot, it gets
+  // placed properly when that slot cascades
+  if (delta >= 1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+    tick = w->now_tick + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+  unsigned int index = (tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  e->slot = level * WHEEL_SLOTS + index;
+  list_push(&w->slots[level][index], e);
+  w->occupied[level] |= 1ULL << index;
+}
+
+void wheel_insert(struct wheel *w, struct sched_entry *e) {
+  w->count++;
+  wheel_place(w, e);
+}
+
+void wheel_remove(struct wheel *w, struct sched_entry *e) {
+  w->count--;
+  if (e->slot == WHEEL_DUE) {
+    if (w->due_tail == e)
+      w->due_tail = e->prev;
+    list_unlink(&w->due, e);
+    return;
+  }
+  unsigned int level = e->slot / WHEEL_SLOTS;
+  unsigned int index = e->slot % WHEEL_SLOTS;
+  list_unlink(&w->slots[level][index], e);
+  if (w->slots[level][index] == NULL)
+    w->occupied[level] &= ~(1ULL << index);
+}
+
+// Re-files every entry of the level's current slot one or more levels down.
+// Returns that slot's index, 0 meaning the level has wrapped too.
+static unsigned int wheel_cascade(struct wheel *w, int level) {
+  unsigned int index = (w->now_tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+  struct sched_entry *e = w->slots[level][index];
+  w->slots[level][index] = NULL;
+  w->occupied[level] &= ~(1ULL << index);
+  while (e != NULL) {
+    struct sched_entry *next = e->next;
+    wheel_place(w, e);
+    e = next;
+  }
+  return index;
+}
+
+static int wheel_upper_occupied(const struct wheel *w) {
+  for (int level = 1; level < WHEEL_LEVELS; level++) {
+    if (w->occupied[level] != 0)
+      return 1;
+  }
+  return 0;
+}
+
+struct sched_entry *wheel_due(struct wheel *w, long long now) {
+  if (now > w->origin_ns) {
+    unsigned long long target = (now - w->origin_ns) / w->tick_ns;
+    while (w->now_tick < target) {
+      unsigned long long tick = w->now_tick + 1;
+      if (w->occupied[0] == 0) {
+        // Nothing can expire before the next level-0 wraparound, so skip
+        // the empty ticks in one go
+        unsigned long long boundary = (w->now_tick | WHEEL_MASK) + 1;
+        if (boundary > target || !wheel_upper_occupied(w)) {
+          w->now_tick = target;
+          break;
+        }
+        tick = boundary;
+      }
+      w->now_tick = tick;
+
+      unsigned int index = tick & WHEEL_MASK;
+      if (index == 0) {
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+          if (wheel_cascade(w, level) != 0)
+            break;
+        }
+      }
+      struct sched_entry *e = w->slots[0][index];
+      w->slots[0][index] = NULL;
+      w->occupied[0] &= ~(1ULL << index);
+      while (e != NULL) {
+        struct sched_entry *next = e->next;
+        due_append(w, e);
+        e = next;
+      }
+    }
+  }
+  return w->due;
+}
+
+long long wheel_next_wakeup(const struct wheel *w) {
+  if (w->due != NULL)
+    return w->origin_ns + w->now_tick * w->tick_ns;
+  if (w->count == 0)
+    return LLONG_MAX;
+
+  unsigned long long tick;
+  unsigned int current = w->now_tick & WHEEL_MASK;
+  // Next occupied level-0 slot after the current one, in wheel order
+  uint64_t ahead = current == WHEEL_MASK ? 0 : w->occupied[0] >> (current + 1);
+  if (ahead != 0) {
+    tick = w->now_tick + 1 + __builtin_ctzll(ahead);
+  } else {
+    // Either wrapped-around level-0 slots or a higher level, both of which
+    // start being served at the next wraparound
+    tick = (w->now_tick | WHEEL_MASK) + 1;
+  }
+  return w->origin_ns + tick * w->tick_ns;
+}
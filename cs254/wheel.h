@@ -0,0 +1,47 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+#include "heap.h"
+
+// Hashed hierarchical timer wheel, an alternative to the deadline heap for
+// very many channels. WHEEL_LEVELS levels of WHEEL_SLOTS slots each; level l
+// holds entries due within 64^(l+1) ticks, and its slot is picked from the
+// tick bits of that level, so insert and expiry are O(1) and an entry is only
+// moved down a level ("cascaded") when the level below wraps around.
+// Deadlines are rounded up to the next tick, so an entry never fires early
+// and fires at most one tick late.
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+#define WHEEL_DUE ((unsigned int)-1) // entry->slot for the expired list
+
+struct wheel {
+  long long origin_ns; // time of tick 0
+  long long tick_ns;
+  unsigned long long now_tick; // every tick up to here has been expired
+  unsigned int count;          // entries on the wheel, including expired
+  uint64_t occupied[WHEEL_LEVELS];
+  struct sched_entry *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  struct sched_entry *due; // expired entries not yet rescheduled
+  struct sched_entry *due_tail;
+};
+
+void wheel_init(struct wheel *w, long long tick_ns, long long now);
+
+void wheel_insert(struct wheel *w, struct sched_entry *e);
+void wheel_remove(struct wheel *w, struct sched_entry *e);
+
+// Expires every tick that has fully elapsed by now. Returns an expired entry,
+// which stays on the expired list until it is removed or reinserted, or NULL.
+struct sched_entry *wheel_due(struct wheel *w, long long now);
+
+// Earliest time at which wheel_due could return something new. May be early
+// (an entry could still be a level up), never late. LLONG_MAX if empty.
+long long wheel_next_wakeup(const struct wheel *w);
+
+#endif
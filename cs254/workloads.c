@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "workloads.h"
+
+#define CACHE_FLUSH_SIZE (10 * 1024 * 1024)
+
+void flush_cache(void) {
+  char *flush_array = (char *)malloc(CACHE_FLUSH_SIZE);
+  for (int i = 0; i < CACHE_FLUSH_SIZE; i++) {
+    flush_array[i] = i;
+  }
+  volatile char temp = flush_array[0]; // prevent optimization
+  (void)temp;
+  free(flush_array);
+}
+
+long long fibonacci(int n) {
+  if (n <= 1)
+    return n;
+  return fibonacci(n - 1) + fibonacci(n - 2);
+}
+
+int no_timing_leak(int secret) {
+  int result = 0;
+  for (int i = 0; i < MAX_SECRET; i++) {
+    int mask = (i < secret); // 1 if i < secret, 0 otherwise
+    result += mask * ((fibonacci(i % 20)) % 5);
+  }
+  return 0;
+}
+
+int diff_output_timing_leak(int secret) {
+  int result = 0;
+  for (int i = 0; i < secret; i++) {
+    result += (fibonacci(i % 20)) % 5;
+  }
+  return result;
+}
+
+int same_output_timing_leak(int secret) {
+  int result = 0;
+  for (int i = 0; i < secret; i++) {
+    result += (fibonacci(i % 20)) % 5;
+  }
+  return 0;
+}
+
+float random_delay(float min, float max) {
+  return min + (max - min) * ((float)rand() / RAND_MAX);
+}
+
+int child_method(int round_num, float delay) {
+  int microseconds = (int)(delay * 1e6);
+  usleep(microseconds);
+  printf("Round %d: Slept for %.2f seconds\n", round_num, delay);
+  return round_num;
+}
+
+int generate_phase_lengths(int *phases, int *num_phases) {
+  int remaining = TOTAL_ROUNDS;
+  int count = 0;
+
+  while (remaining > 0 && count < MAX_PHASES - 1) {
+    int reserve = MIN_PHASES - count - 1; // Ensure room for the rest
+    int max_len = remaining - (reserve > 0 ? reserve : 0);
+    int len = (rand() % max_len) + 1;
+    phases[count++] = len;
+    remaining -= len;
+  }
+
+  // Final phase gets whatever is left
+  phases[count++] = remaining;
+  *num_phases = count;
+  return 0;
+}
+
+void parent_method(void) {
+  int phases[MAX_PHASES];
+  int num_phases = 0;
+
+  if (generate_phase_lengths(phases, &num_phases) != 0) {
+    printf("error!!");
+    return;
+  }
+
+  printf("Generated %d phases:\n", num_phases);
+  for (int i = 0; i < num_phases; i++) {
+    printf("  Phase %d: %d rounds\n", i + 1, phases[i]);
+  }
+
+  int round_counter = 1;
+  for (int i = 0; i < num_phases; i++) {
+    float delay = random_delay(0, 4); // Delay for this phase
+    printf("Phase %d: Using delay = %.2f seconds\n", i + 1, delay);
+    for (int j = 0; j < phases[i]; j++) {
+      child_method(round_counter++, delay); // This should go into the array and be slowed down!!!
+    }
+  }
+}
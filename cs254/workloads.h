@@ -0,0 +1,39 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+// Example target functions for the mitigators, with and without timing leaks
+
+#define MAX_SECRET 1048576
+
+#define TOTAL_ROUNDS 50
+#define MAX_PHASES 20
+#define MIN_PHASES 3
+
+// Evicts the caches before a run so the first secrets aren't favoured
+void flush_cache(void);
+
+// Fibonacci (target func example)
+long long fibonacci(int n);
+
+// No timing leak
+int no_timing_leak(int secret);
+
+// Timing leak where output depends on secret
+int diff_output_timing_leak(int secret);
+
+// Timing leak where output is constant
+int same_output_timing_leak(int secret);
+
+// Uniform delay in [min, max] seconds
+float random_delay(float min, float max);
+
+// Child function: uses a fixed delay and returns the round number
+int child_method(int round_num, float delay);
+
+// Splits TOTAL_ROUNDS into at least MIN_PHASES random-length phases
+int generate_phase_lengths(int *phases, int *num_phases);
+
+// Runs TOTAL_ROUNDS of child_method in phases with different delays
+void parent_method(void);
+
+#endif